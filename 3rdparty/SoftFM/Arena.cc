@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+#include "Arena.h"
+
+using namespace std;
+
+
+/* ****************  class Arena  **************** */
+
+constexpr size_t Arena::alignment;
+constexpr size_t Arena::huge_page_size;
+
+
+// Construct arena.
+Arena::Arena(size_t size, bool huge_pages)
+    : m_base(nullptr)
+    , m_size(size)
+    , m_used(0)
+    , m_huge_pages(false)
+{
+    size_t align = alignment;
+
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages need a region aligned to the huge page size.
+    if (huge_pages) {
+        align  = huge_page_size;
+        m_size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    }
+#endif
+
+    void * p = nullptr;
+    if (posix_memalign(&p, align, (m_size > 0) ? m_size : align) != 0)
+        throw bad_alloc();
+    m_base = static_cast<char *>(p);
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages)
+        m_huge_pages = (madvise(p, m_size, MADV_HUGEPAGE) == 0);
+#endif
+}
+
+
+// Release the region.
+Arena::~Arena()
+{
+    free(m_base);
+}
+
+/* end */
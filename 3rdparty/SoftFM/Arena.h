@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTFM_ARENA_H
+#define SOFTFM_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+
+/**
+ *  Contiguous memory region for working buffers.
+ *
+ *  All buffers are carved from a single allocation made at construction.
+ *  Every buffer starts on a cache line boundary, so SIMD loads never
+ *  split across lines. Optionally the region is backed by huge pages
+ *  to reduce TLB misses.
+ *
+ *  The arena never frees individual buffers. Memory is released when
+ *  the arena is destroyed.
+ */
+class Arena
+{
+public:
+
+    /** Alignment of each buffer in bytes. */
+    static constexpr std::size_t alignment = 64;
+
+    /** Huge page size in bytes. */
+    static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+
+    /** Return the number of bytes taken by a buffer of n elements. */
+    template <class T>
+    static std::size_t buffer_size(std::size_t n)
+    {
+        return (n * sizeof(T) + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * Construct arena.
+     *
+     * size       :: Total size in bytes; the sum of buffer_size()
+     *               of all buffers that will be allocated.
+     * huge_pages :: True to request huge pages for the region.
+     */
+    explicit Arena(std::size_t size, bool huge_pages=false);
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Allocate a buffer of n value-initialized elements.
+     * The arena must have room for buffer_size<T>(n) more bytes.
+     */
+    template <class T>
+    T * allocate(std::size_t n)
+    {
+        std::size_t k = buffer_size<T>(n);
+        assert(m_used + k <= m_size);
+        T * p = reinterpret_cast<T *>(m_base + m_used);
+        std::uninitialized_fill_n(p, n, T());
+        m_used += k;
+        return p;
+    }
+
+    /** Return the size of the region in bytes. */
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    /** Return true if the region is backed by huge pages. */
+    bool huge_pages() const
+    {
+        return m_huge_pages;
+    }
+
+private:
+    char *          m_base;
+    std::size_t     m_size;
+    std::size_t     m_used;
+    bool            m_huge_pages;
+};
+
+#endif
@@ -51,6 +51,7 @@
 
 #include "SoftFM.h"
 #include "AudioOutput.h"
+#include "DspKernels.h"
 
 using namespace std;
 
@@ -62,19 +63,8 @@ void AudioOutput::samplesToInt16(const SampleVector& samples,
                                  vector<uint8_t>& bytes)
 {
     bytes.resize(2 * samples.size());
-
-    SampleVector::const_iterator i = samples.begin();
-    SampleVector::const_iterator n = samples.end();
-    vector<uint8_t>::iterator k = bytes.begin();
-
-    while (i != n) {
-        Sample s = *(i++);
-        s = max(Sample(-1.0), min(Sample(1.0), s));
-        long v = lrint(s * 32767);
-        unsigned long u = v;
-        *(k++) = u & 0xff;
-        *(k++) = (u >> 8) & 0xff;
-    }
+    dsp_kernels().convert_s16le(samples.data(), samples.size(), 1.0,
+                                bytes.data());
 }
 
 
@@ -114,18 +104,25 @@ RawAudioOutput::~RawAudioOutput()
 // Write audio data.
 bool RawAudioOutput::write(const SampleVector& samples)
 {
-    if (m_fd < 0)
-        return false;
-
     // Convert samples to bytes.
     samplesToInt16(samples, m_bytebuf);
 
+    return write_s16le(m_bytebuf.data(), samples.size());
+}
+
+
+// Write encoded audio data.
+bool RawAudioOutput::write_s16le(const uint8_t * pcm, unsigned int nsamples)
+{
+    if (m_fd < 0)
+        return false;
+
     // Write data.
     size_t p = 0;
-    size_t n = m_bytebuf.size();
+    size_t n = 2 * size_t(nsamples);
     while (p < n) {
 
-        ssize_t k = ::write(m_fd, m_bytebuf.data() + p, n - p);
+        ssize_t k = ::write(m_fd, pcm + p, n - p);
         if (k <= 0) {
             if (k == 0 || errno != EINTR) {
                 m_error = "write failed (";
@@ -204,15 +201,22 @@ WavAudioOutput::~WavAudioOutput()
 // Write audio data.
 bool WavAudioOutput::write(const SampleVector& samples)
 {
-    if (m_zombie)
-        return false;
-
     // Convert samples to bytes.
     samplesToInt16(samples, m_bytebuf);
 
+    return write_s16le(m_bytebuf.data(), samples.size());
+}
+
+
+// Write encoded audio data.
+bool WavAudioOutput::write_s16le(const uint8_t * pcm, unsigned int n)
+{
+    if (m_zombie)
+        return false;
+
     // Write samples to file.
-    size_t k = fwrite(m_bytebuf.data(), 1, m_bytebuf.size(), m_stream);
-    if (k != m_bytebuf.size()) {
+    size_t k = fwrite(pcm, 1, 2 * size_t(n), m_stream);
+    if (k != 2 * size_t(n)) {
         m_error = "write failed (";
         m_error += strerror(errno);
         m_error += ")";
@@ -283,13 +287,31 @@ void WavAudioOutput::set_value(uint8_t * ptr, T value)
 
 /* ****************  class AlsaAudioOutput  **************** */
 
+// Common sample rates, in order of preference at equal distance.
+const unsigned int AlsaAudioOutput::common_rates[] = {
+    48000, 44100, 96000, 88200, 32000, 192000, 176400, 24000, 22050, 16000
+};
+
+
+// Format an ALSA error message.
+static string alsa_error(const char * what, int r)
+{
+    return string(what) + " (" + strerror(-r) + ")";
+}
+
+
 // Construct ALSA output stream.
 AlsaAudioOutput::AlsaAudioOutput(const std::string& devname,
                                  unsigned int samplerate,
-                                 bool stereo)
+                                 bool stereo,
+                                 unsigned int latency)
+    : m_delay(0)
 {
     m_pcm = NULL;
     m_nchannels = stereo ? 2 : 1;
+    m_samplerate = 0;
+    m_mmap = true;
+    m_period_frames = 0;
 
     int r = snd_pcm_open(&m_pcm, devname.c_str(),
                          SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
@@ -303,20 +325,120 @@ AlsaAudioOutput::AlsaAudioOutput(const std::string& devname,
 
     snd_pcm_nonblock(m_pcm, 0);
 
-    r = snd_pcm_set_params(m_pcm,
-                           SND_PCM_FORMAT_S16_LE,
-                           SND_PCM_ACCESS_RW_INTERLEAVED,
-                           m_nchannels,
-                           samplerate,
-                           1,               // allow soft resampling
-                           500000);         // latency in us
+    if (!configure(samplerate, latency)) {
+        m_zombie = true;
+        return;
+    }
+}
+
 
+// Configure the device without resampling.
+bool AlsaAudioOutput::configure(unsigned int samplerate, unsigned int latency)
+{
+    snd_pcm_hw_params_t * hwparams;
+    snd_pcm_sw_params_t * swparams;
+    snd_pcm_hw_params_alloca(&hwparams);
+    snd_pcm_sw_params_alloca(&swparams);
+
+    int r = snd_pcm_hw_params_any(m_pcm, hwparams);
     if (r < 0) {
-        m_error = "can not set PCM parameters (";
-        m_error += strerror(-r);
-        m_error += ")";
-        m_zombie = true;
+        m_error = alsa_error("can not get PCM parameters", r);
+        return false;
+    }
+
+    // Do not let the plug layer resample; only native rates remain.
+    r = snd_pcm_hw_params_set_rate_resample(m_pcm, hwparams, 0);
+    if (r < 0) {
+        m_error = alsa_error("can not disable PCM resampling", r);
+        return false;
+    }
+
+    // Prefer direct access to the ring buffer, so samples can be
+    // converted in place. Fall back to read/write access if the
+    // device does not support it.
+    m_mmap = (snd_pcm_hw_params_test_access(
+                  m_pcm, hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
+    r = snd_pcm_hw_params_set_access(m_pcm, hwparams,
+                                     m_mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+                                            : SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (r < 0) {
+        m_error = alsa_error("can not set PCM access", r);
+        return false;
+    }
+
+    r = snd_pcm_hw_params_set_format(m_pcm, hwparams, SND_PCM_FORMAT_S16_LE);
+    if (r < 0) {
+        m_error = alsa_error("PCM device does not support S16_LE", r);
+        return false;
+    }
+
+    r = snd_pcm_hw_params_set_channels(m_pcm, hwparams, m_nchannels);
+    if (r < 0) {
+        m_error = alsa_error(m_nchannels == 2 ?
+                             "PCM device does not support stereo" :
+                             "PCM device does not support mono", r);
+        return false;
+    }
+
+    // Take the preferred rate if the device plays it natively,
+    // otherwise the closest native rate.
+    unsigned int rate = 0;
+    if (snd_pcm_hw_params_test_rate(m_pcm, hwparams, samplerate, 0) == 0) {
+        rate = samplerate;
+    } else {
+        for (unsigned int c : common_rates) {
+            if (snd_pcm_hw_params_test_rate(m_pcm, hwparams, c, 0) == 0 &&
+                (rate == 0 || max(c, samplerate) - min(c, samplerate)
+                              < max(rate, samplerate) - min(rate, samplerate)))
+                rate = c;
+        }
+    }
+    if (rate == 0) {
+        m_error = "PCM device has no native sample rate near " +
+                  to_string(samplerate) + " Hz";
+        return false;
+    }
+
+    r = snd_pcm_hw_params_set_rate(m_pcm, hwparams, rate, 0);
+    if (r < 0) {
+        m_error = alsa_error("can not set PCM sample rate", r);
+        return false;
     }
+
+    // Buffer of the requested latency in 4 periods.
+    unsigned int buffer_time = latency;
+    unsigned int period_time = buffer_time / 4;
+    snd_pcm_hw_params_set_buffer_time_near(m_pcm, hwparams,
+                                           &buffer_time, NULL);
+    snd_pcm_hw_params_set_period_time_near(m_pcm, hwparams,
+                                           &period_time, NULL);
+
+    r = snd_pcm_hw_params(m_pcm, hwparams);
+    if (r < 0) {
+        m_error = alsa_error("can not set PCM parameters", r);
+        return false;
+    }
+
+    snd_pcm_uframes_t buffer_size, period_size;
+    snd_pcm_hw_params_get_buffer_size(hwparams, &buffer_size);
+    snd_pcm_hw_params_get_period_size(hwparams, &period_size, NULL);
+
+    // Start playback once the buffer is full; wake up per period.
+    r = snd_pcm_sw_params_current(m_pcm, swparams);
+    if (r >= 0) {
+        snd_pcm_sw_params_set_start_threshold(
+            m_pcm, swparams, buffer_size - buffer_size % period_size);
+        snd_pcm_sw_params_set_avail_min(m_pcm, swparams, period_size);
+        r = snd_pcm_sw_params(m_pcm, swparams);
+    }
+    if (r < 0) {
+        m_error = alsa_error("can not set PCM software parameters", r);
+        return false;
+    }
+
+    m_samplerate = rate;
+    m_period_frames = period_size;
+    return true;
 }
 
 
@@ -336,17 +458,33 @@ bool AlsaAudioOutput::write(const SampleVector& samples)
     if (m_zombie)
         return false;
 
+    // Convert samples directly into the ring buffer.
+    if (m_mmap)
+        return write_mmap(samples.data(), NULL, samples.size());
+
     // Convert samples to bytes.
     samplesToInt16(samples, m_bytebuf);
 
+    return write_s16le(m_bytebuf.data(), samples.size());
+}
+
+
+// Write encoded audio data.
+bool AlsaAudioOutput::write_s16le(const uint8_t * pcm, unsigned int nsamples)
+{
+    if (m_zombie)
+        return false;
+
+    if (m_mmap)
+        return write_mmap(NULL, pcm, nsamples);
+
     // Write data.
     unsigned int p = 0;
-    unsigned int n = samples.size() / m_nchannels;
+    unsigned int n = nsamples / m_nchannels;
     unsigned int framesize = 2 * m_nchannels;
     while (p < n) {
 
-        int k = snd_pcm_writei(m_pcm,
-                               m_bytebuf.data() + p * framesize, n - p);
+        int k = snd_pcm_writei(m_pcm, pcm + p * framesize, n - p);
         if (k < 0) {
             m_error = "write failed (";
             m_error += strerror(errno);
@@ -360,6 +498,88 @@ bool AlsaAudioOutput::write(const SampleVector& samples)
         }
     }
 
+    update_delay();
+    return true;
+}
+
+
+// Return the number of frames not yet played.
+unsigned long AlsaAudioOutput::get_delay() const
+{
+    return m_delay.load();
+}
+
+
+// Measure the playback delay after a write.
+void AlsaAudioOutput::update_delay()
+{
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay(m_pcm, &delay) >= 0)
+        m_delay.store(delay > 0 ? delay : 0);
+}
+
+
+// Write audio data directly into the mmap ring buffer.
+bool AlsaAudioOutput::write_mmap(const Sample * samples, const uint8_t * pcm,
+                                 unsigned int nsamples)
+{
+    const DspKernels& kernels = dsp_kernels();
+
+    snd_pcm_uframes_t p = 0;
+    snd_pcm_uframes_t n = nsamples / m_nchannels;
+    unsigned int framesize = 2 * m_nchannels;
+    while (p < n) {
+
+        int r = 0;
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pcm);
+        if (avail < 0) {
+            r = avail;
+        } else if (snd_pcm_uframes_t(avail) < min(n - p, m_period_frames)) {
+            // Not enough room in the ring buffer. Start playback if the
+            // buffer has been filled for the first time, otherwise wait
+            // until the device has consumed a period.
+            if (snd_pcm_state(m_pcm) == SND_PCM_STATE_PREPARED)
+                r = snd_pcm_start(m_pcm);
+            else
+                r = snd_pcm_wait(m_pcm, -1);
+            if (r >= 0)
+                continue;
+        } else {
+            // Fill (part of) the free area of the ring buffer.
+            const snd_pcm_channel_area_t * areas;
+            snd_pcm_uframes_t offset;
+            snd_pcm_uframes_t frames = n - p;
+            r = snd_pcm_mmap_begin(m_pcm, &areas, &offset, &frames);
+            if (r >= 0) {
+                uint8_t * dst = static_cast<uint8_t *>(areas[0].addr) +
+                                (areas[0].first + offset * areas[0].step) / 8;
+                if (samples != NULL) {
+                    kernels.convert_s16le(samples + p * m_nchannels,
+                                          frames * m_nchannels, 1.0, dst);
+                } else {
+                    memcpy(dst, pcm + p * framesize, frames * framesize);
+                }
+                snd_pcm_sframes_t k = snd_pcm_mmap_commit(m_pcm, offset,
+                                                          frames);
+                if (k >= 0 && snd_pcm_uframes_t(k) != frames)
+                    k = -EPIPE;
+                r = (k < 0) ? k : 0;
+                p += frames;
+            }
+        }
+
+        if (r < 0) {
+            m_error = "write failed (";
+            m_error += strerror(-r);
+            m_error += ")";
+            // After an underrun, ALSA keeps returning error codes until we
+            // explicitly fix the stream.
+            snd_pcm_recover(m_pcm, r, 0);
+            return false;
+        }
+    }
+
+    update_delay();
     return true;
 }
 
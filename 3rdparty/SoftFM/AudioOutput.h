@@ -38,6 +38,7 @@
 #ifndef SOFTFM_AUDIOOUTPUT_H
 #define SOFTFM_AUDIOOUTPUT_H
 
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <string>
@@ -62,6 +63,27 @@ public:
      */
     virtual bool write(const SampleVector& samples) = 0;
 
+    /**
+     * Write audio data encoded as signed 16-bit little-endian integers.
+     *
+     * pcm      :: 2 * n bytes of encoded audio data
+     * n        :: number of samples (not frames)
+     *
+     * Return true on success.
+     * Return false if an error occurs.
+     */
+    virtual bool write_s16le(const std::uint8_t * pcm, unsigned int n) = 0;
+
+    /**
+     * Return the number of frames that were written but not yet played,
+     * as measured after the last write. Files have no playback delay.
+     * May be called from any thread.
+     */
+    virtual unsigned long get_delay() const
+    {
+        return 0;
+    }
+
     /** Return the last error, or return an empty string if there is no error. */
     std::string error()
     {
@@ -107,6 +129,7 @@ public:
 
     ~RawAudioOutput();
     bool write(const SampleVector& samples);
+    bool write_s16le(const std::uint8_t * pcm, unsigned int n);
 
 private:
     int m_fd;
@@ -132,6 +155,7 @@ public:
 
     ~WavAudioOutput();
     bool write(const SampleVector& samples);
+    bool write_s16le(const std::uint8_t * pcm, unsigned int n);
 
 private:
 
@@ -155,23 +179,66 @@ class AlsaAudioOutput : public AudioOutput
 {
 public:
 
+    /** Common sample rates tried when the preferred rate is not native. */
+    static const unsigned int common_rates[];
+
+    /** Default device buffer length in microseconds. */
+    static const unsigned int default_latency = 500000;
+
     /**
      * Construct ALSA output stream.
      *
      * dename       :: ALSA PCM device
-     * samplerate   :: audio sample rate in Hz
+     * samplerate   :: preferred audio sample rate in Hz
      * stereo       :: true if the output stream contains stereo data
+     * latency      :: device buffer length in microseconds, split in
+     *                 4 periods
+     *
+     * ALSA is not allowed to resample. If the device does not play the
+     * preferred rate natively, the closest native rate from common_rates
+     * is used instead; the caller must produce get_sample_rate().
+     * If there is no native rate, the stream fails with an error.
      */
     AlsaAudioOutput(const std::string& devname,
                     unsigned int samplerate,
-                    bool stereo);
+                    bool stereo,
+                    unsigned int latency=default_latency);
 
     ~AlsaAudioOutput();
     bool write(const SampleVector& samples);
+    bool write_s16le(const std::uint8_t * pcm, unsigned int n);
+    unsigned long get_delay() const;
+
+    /** Return the sample rate of the device in Hz. */
+    unsigned int get_sample_rate() const
+    {
+        return m_samplerate;
+    }
 
 private:
+
+    /**
+     * Configure the device for the preferred sample rate or the closest
+     * native rate. Return false and set the error on failure.
+     */
+    bool configure(unsigned int samplerate, unsigned int latency);
+
+    /** Measure the playback delay after a write. */
+    void update_delay();
+
+    /**
+     * Write n samples directly into the mmap ring buffer.
+     * Either convert samples, or copy encoded data from pcm.
+     */
+    bool write_mmap(const Sample * samples, const std::uint8_t * pcm,
+                    unsigned int n);
+
     unsigned int         m_nchannels;
+    unsigned int         m_samplerate;
     struct _snd_pcm *    m_pcm;
+    bool                 m_mmap;
+    unsigned long        m_period_frames;
+    std::atomic<unsigned long> m_delay;
     std::vector<std::uint8_t> m_bytebuf;
 };
 
@@ -0,0 +1,1255 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "DspKernels.h"
+
+using namespace std;
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define DSP_X86 1
+#endif
+
+#define DSP_INLINE inline __attribute__((always_inline))
+
+
+/* ****************  kernel bodies  **************** */
+
+// The kernel bodies below are templates on the vector width in bytes.
+// They are always inlined into per-level wrapper functions, which are
+// compiled for the instruction set of that level.
+
+/** Vector of (Bytes / sizeof(T)) elements of type T. */
+template <class T, unsigned int Bytes>
+struct DspVec
+{
+    static constexpr unsigned int lanes = Bytes / sizeof(T);
+
+    typedef T type __attribute__((vector_size(Bytes)));
+    typedef T unaligned_type
+        __attribute__((vector_size(Bytes), aligned(sizeof(T)), may_alias));
+
+    /** Access (lanes) elements at p as a vector, p need not be aligned. */
+    static DSP_INLINE const unaligned_type * at(const T * p)
+    {
+        return reinterpret_cast<const unaligned_type *>(p);
+    }
+
+    static DSP_INLINE unaligned_type * at(T * p)
+    {
+        return reinterpret_cast<unaligned_type *>(p);
+    }
+};
+
+
+/** Return the sums of the even and odd lanes of an interleaved IQ vector. */
+template <unsigned int Bytes>
+static DSP_INLINE IQSample sum_iq_lanes(
+    const typename DspVec<float, Bytes>::type& v)
+{
+    typedef DspVec<int32_t, Bytes> M;
+    const unsigned int lanes = DspVec<float, Bytes>::lanes;
+
+    // Repeatedly add the upper half of the vector to the lower half.
+    typename DspVec<float, Bytes>::type acc = v;
+    for (unsigned int w = lanes / 2; w >= 2; w /= 2) {
+        typename M::type rot;
+        for (unsigned int k = 0; k < lanes; k++)
+            rot[k] = (k + w) % lanes;
+        acc += __builtin_shuffle(acc, rot);
+    }
+    return IQSample(acc[0], acc[1]);
+}
+
+
+/**
+ * Approximate r = atan2(y, x) for scalars or vectors of float.
+ * Maximum error is about 1e-7 radians (Abramowitz and Stegun 4.4.49).
+ */
+template <class F>
+static DSP_INLINE void atan2_approx(const F& y, const F& x, F& r)
+{
+    F ax = (x < 0) ? -x : x;
+    F ay = (y < 0) ? -y : y;
+    F mx = (ay > ax) ? ay : ax;
+    F mn = (ay > ax) ? ax : ay;
+    F a  = mn / ((mx > 0) ? mx : mx + 1.0f);
+    F s  = a * a;
+    r = s * -0.0040540580f + 0.0218612288f;
+    r = r * s - 0.0559098861f;
+    r = r * s + 0.0964200441f;
+    r = r * s - 0.1390853351f;
+    r = r * s + 0.1994653599f;
+    r = r * s - 0.3332985605f;
+    r = r * s + 0.9999993329f;
+    r = r * a;
+    r = (ay > ax) ? float(M_PI / 2) - r : r;
+    r = (x < 0) ? float(M_PI) - r : r;
+    r = (y < 0) ? -r : r;
+}
+
+
+/** Phase difference between two successive IQ samples. */
+static DSP_INLINE float phase_diff_one(IQSample s0, IQSample s1)
+{
+    float dr = s0.real() * s1.real() + s0.imag() * s1.imag();
+    float di = s0.real() * s1.imag() - s0.imag() * s1.real();
+    float w;
+    atan2_approx(di, dr, w);
+    return w;
+}
+
+
+template <class T, unsigned int Bytes>
+static DSP_INLINE T dot_body(const T * x, const T * c, unsigned int n)
+{
+    typedef DspVec<T, Bytes> V;
+    const unsigned int lanes = V::lanes;
+
+    typename V::type acc0 = { }, acc1 = { };
+    unsigned int i = 0;
+    for (; i + 2 * lanes <= n; i += 2 * lanes) {
+        acc0 += *V::at(x + i) * *V::at(c + i);
+        acc1 += *V::at(x + i + lanes) * *V::at(c + i + lanes);
+    }
+    if (i + lanes <= n) {
+        acc0 += *V::at(x + i) * *V::at(c + i);
+        i += lanes;
+    }
+    acc0 += acc1;
+
+    T y = 0;
+    for (unsigned int k = 0; k < lanes; k++)
+        y += acc0[k];
+    for (; i < n; i++)
+        y += x[i] * c[i];
+    return y;
+}
+
+
+template <class T, unsigned int Bytes>
+static DSP_INLINE void dot2_body(const T * x, const T * a, const T * b,
+                                 unsigned int n, T * ya, T * yb)
+{
+    typedef DspVec<T, Bytes> V;
+    const unsigned int lanes = V::lanes;
+
+    typename V::type acca = { }, accb = { };
+    unsigned int i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        typename V::type v = *V::at(x + i);
+        acca += v * *V::at(a + i);
+        accb += v * *V::at(b + i);
+    }
+
+    T sa = 0, sb = 0;
+    for (unsigned int k = 0; k < lanes; k++) {
+        sa += acca[k];
+        sb += accb[k];
+    }
+    for (; i < n; i++) {
+        sa += x[i] * a[i];
+        sb += x[i] * b[i];
+    }
+    *ya = sa;
+    *yb = sb;
+}
+
+
+/**
+ * Symmetric dot product of split IQ samples. If Taps is non-zero, it is
+ * the filter length as a compile-time constant and the argument n is ignored.
+ */
+template <unsigned int Bytes, unsigned int Taps>
+static DSP_INLINE IQSample dot_split_sym_body(const float * xr,
+                                              const float * xi,
+                                              const float * c, unsigned int n)
+{
+    typedef DspVec<float, Bytes> V;
+    typedef DspVec<int32_t, Bytes> M;
+    const unsigned int lanes = V::lanes;
+
+    if (Taps != 0)
+        n = Taps;
+    unsigned int h = n / 2;
+
+    // Mask which reverses the order of the lanes of a vector.
+    typename M::type rev;
+    for (unsigned int k = 0; k < lanes; k++)
+        rev[k] = lanes - 1 - k;
+
+    // Add sample j to sample (n-1-j), then multiply by coefficient j.
+    // The real and imaginary parts share the coefficient vector.
+    typename V::type accr = { }, acci = { }, accr1 = { }, acci1 = { };
+    unsigned int j = 0;
+    for (; j + 2 * lanes <= h; j += 2 * lanes) {
+        typename V::type c0 = *V::at(c + j);
+        typename V::type c1 = *V::at(c + j + lanes);
+        accr  += (*V::at(xr + j) +
+                  __builtin_shuffle(*V::at(xr + n - j - lanes), rev)) * c0;
+        acci  += (*V::at(xi + j) +
+                  __builtin_shuffle(*V::at(xi + n - j - lanes), rev)) * c0;
+        accr1 += (*V::at(xr + j + lanes) +
+                  __builtin_shuffle(*V::at(xr + n - j - 2 * lanes), rev)) * c1;
+        acci1 += (*V::at(xi + j + lanes) +
+                  __builtin_shuffle(*V::at(xi + n - j - 2 * lanes), rev)) * c1;
+    }
+    if (j + lanes <= h) {
+        typename V::type cv = *V::at(c + j);
+        accr += (*V::at(xr + j) +
+                 __builtin_shuffle(*V::at(xr + n - j - lanes), rev)) * cv;
+        acci += (*V::at(xi + j) +
+                 __builtin_shuffle(*V::at(xi + n - j - lanes), rev)) * cv;
+        j += lanes;
+    }
+    accr += accr1;
+    acci += acci1;
+
+    // Fewer than (lanes) pairs remain. If a full vector fits inside
+    // the filter, process them with the unused lanes masked out.
+    if (j < h && j + lanes <= n) {
+        typename M::type idx;
+        for (unsigned int k = 0; k < lanes; k++)
+            idx[k] = k;
+        typename V::type zero = { };
+        typename V::type cv = *V::at(c + j);
+        cv = (idx < int32_t(h - j)) ? cv : zero;
+        accr += (*V::at(xr + j) +
+                 __builtin_shuffle(*V::at(xr + n - j - lanes), rev)) * cv;
+        acci += (*V::at(xi + j) +
+                 __builtin_shuffle(*V::at(xi + n - j - lanes), rev)) * cv;
+        j = h;
+    }
+
+    // Interleave the halves of both accumulators, then sum as IQ pairs.
+    typename M::type lo, hi;
+    for (unsigned int k = 0; k < lanes; k++) {
+        lo[k] = ((k & 1) ? lanes : 0) + k / 2;
+        hi[k] = lo[k] + lanes / 2;
+    }
+    IQSample y = sum_iq_lanes<Bytes>(__builtin_shuffle(accr, acci, lo) +
+                                     __builtin_shuffle(accr, acci, hi));
+    float yr = y.real(), yi = y.imag();
+    for (; j < h; j++) {
+        yr += (xr[j] + xr[n-1-j]) * c[j];
+        yi += (xi[j] + xi[n-1-j]) * c[j];
+    }
+    if (n & 1) {
+        yr += xr[h] * c[h];
+        yi += xi[h] * c[h];
+    }
+    return IQSample(yr, yi);
+}
+
+
+/**
+ * Select a specialized symmetric split IQ dot product for the filter
+ * lengths of DownconverterIQ. FmDecoder::if_filter_order() gives
+ * (32 * k + 1) taps for a final decimation by k, and 11 taps without
+ * decimation. After the half-band stages, k is 2 or 3 for the common
+ * factors; longer filters gain nothing measurable from a constant length.
+ */
+template <unsigned int Bytes>
+static DSP_INLINE IQSample dot_split_sym_select(const float * xr,
+                                                const float * xi,
+                                                const float * c,
+                                                unsigned int n)
+{
+#define DSP_SYM_CASE(taps) \
+        case taps: return dot_split_sym_body<Bytes, taps>(xr, xi, c, taps);
+
+    switch (n) {
+        DSP_SYM_CASE(11)
+        DSP_SYM_CASE(32 * 2 + 1)
+        DSP_SYM_CASE(32 * 3 + 1)
+        default: return dot_split_sym_body<Bytes, 0>(xr, xi, c, n);
+    }
+
+#undef DSP_SYM_CASE
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void fir_decim2_body(const float * x, unsigned int n,
+                                       const float * c, unsigned int taps,
+                                       float * y)
+{
+    typedef DspVec<float, Bytes> V;
+    typedef DspVec<int32_t, Bytes> M;
+    const unsigned int lanes = V::lanes;
+    const unsigned int span = 512;
+
+    // Collect the non-zero coefficients of the even and odd samples.
+    float ce[dsp_decim2_max_taps], co[dsp_decim2_max_taps];
+    unsigned int ie[dsp_decim2_max_taps], io[dsp_decim2_max_taps];
+    unsigned int ne = 0, no = 0;
+    for (unsigned int j = 0; j < taps; j++) {
+        if (c[j] == 0)
+            continue;
+        if (j % 2 == 0) {
+            ce[ne] = c[j];
+            ie[ne++] = j / 2;
+        } else {
+            co[no] = c[j];
+            io[no++] = j / 2;
+        }
+    }
+
+    // Masks which select the even and odd samples from two vectors.
+    typename M::type even, odd;
+    for (unsigned int k = 0; k < lanes; k++) {
+        even[k] = 2 * k;
+        odd[k]  = 2 * k + 1;
+    }
+
+    // Split blocks of the input into even and odd samples. Successive
+    // outputs then use successive elements of each, so each vector
+    // holds (lanes) outputs.
+    const unsigned int nhist = (taps + 1) / 2;
+    float ev[span], od[span];
+    for (unsigned int m0 = 0; m0 < n; ) {
+        unsigned int b = std::min(n - m0, span - nhist);
+        unsigned int npair = b + nhist - 1;
+        unsigned int avail = 2 * (b - 1) + taps;
+        const float * xb = x + 2 * m0;
+
+        unsigned int j = 0;
+        for (; 2 * (j + lanes) <= avail; j += lanes) {
+            typename V::type p0 = *V::at(xb + 2 * j);
+            typename V::type p1 = *V::at(xb + 2 * j + lanes);
+            *V::at(ev + j) = __builtin_shuffle(p0, p1, even);
+            *V::at(od + j) = __builtin_shuffle(p0, p1, odd);
+        }
+        for (; j < npair; j++) {
+            ev[j] = xb[2*j];
+            od[j] = (2 * j + 1 < avail) ? xb[2*j+1] : 0;
+        }
+
+        // Compute four vectors at a time to hide the latency of
+        // the accumulation.
+        unsigned int m = 0;
+        for (; m + 4 * lanes <= b; m += 4 * lanes) {
+            typename V::type acc0 = { }, acc1 = { }, acc2 = { }, acc3 = { };
+            for (unsigned int t = 0; t < ne; t++) {
+                const float * e = ev + m + ie[t];
+                acc0 += *V::at(e) * ce[t];
+                acc1 += *V::at(e + lanes) * ce[t];
+                acc2 += *V::at(e + 2 * lanes) * ce[t];
+                acc3 += *V::at(e + 3 * lanes) * ce[t];
+            }
+            for (unsigned int t = 0; t < no; t++) {
+                const float * o = od + m + io[t];
+                acc0 += *V::at(o) * co[t];
+                acc1 += *V::at(o + lanes) * co[t];
+                acc2 += *V::at(o + 2 * lanes) * co[t];
+                acc3 += *V::at(o + 3 * lanes) * co[t];
+            }
+            *V::at(y + m0 + m) = acc0;
+            *V::at(y + m0 + m + lanes) = acc1;
+            *V::at(y + m0 + m + 2 * lanes) = acc2;
+            *V::at(y + m0 + m + 3 * lanes) = acc3;
+        }
+        for (; m + lanes <= b; m += lanes) {
+            typename V::type acc = { };
+            for (unsigned int t = 0; t < ne; t++)
+                acc += *V::at(ev + m + ie[t]) * ce[t];
+            for (unsigned int t = 0; t < no; t++)
+                acc += *V::at(od + m + io[t]) * co[t];
+            *V::at(y + m0 + m) = acc;
+        }
+        for (; m < b; m++) {
+            float acc = 0;
+            for (unsigned int t = 0; t < ne; t++)
+                acc += ev[m+ie[t]] * ce[t];
+            for (unsigned int t = 0; t < no; t++)
+                acc += od[m+io[t]] * co[t];
+            y[m0+m] = acc;
+        }
+
+        m0 += b;
+    }
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void phase_diff_body(const IQSample * x, unsigned int n,
+                                       IQSample prev, float scale, Sample * y)
+{
+    typedef DspVec<float, Bytes> V;
+    const unsigned int lanes = V::lanes;
+
+    if (n == 0)
+        return;
+
+    y[0] = scale * phase_diff_one(prev, x[0]);
+
+    // From here on the previous sample is x[i-1].
+    const float * p = reinterpret_cast<const float *>(x);
+    unsigned int i = 1;
+    for (; i + lanes <= n; i += lanes) {
+        typename V::type ar, ai, br, bi;
+        for (unsigned int k = 0; k < lanes; k++) {
+            ar[k] = p[2*(i+k)-2];
+            ai[k] = p[2*(i+k)-1];
+            br[k] = p[2*(i+k)];
+            bi[k] = p[2*(i+k)+1];
+        }
+        typename V::type dr = ar * br + ai * bi;
+        typename V::type di = ar * bi - ai * br;
+        typename V::type w;
+        atan2_approx(di, dr, w);
+        w *= scale;
+        for (unsigned int k = 0; k < lanes; k++)
+            y[i+k] = w[k];
+    }
+
+    for (; i < n; i++)
+        y[i] = scale * phase_diff_one(x[i-1], x[i]);
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void phase_diff_split_body(const float * xr,
+                                             const float * xi, unsigned int n,
+                                             IQSample prev, float scale,
+                                             Sample * y)
+{
+    typedef DspVec<float, Bytes> V;
+    const unsigned int lanes = V::lanes;
+
+    if (n == 0)
+        return;
+
+    y[0] = scale * phase_diff_one(prev, IQSample(xr[0], xi[0]));
+
+    // From here on the previous sample is x[i-1]. In split layout,
+    // both samples of each pair are plain vector loads.
+    unsigned int i = 1;
+    for (; i + lanes <= n; i += lanes) {
+        typename V::type ar = *V::at(xr + i - 1);
+        typename V::type ai = *V::at(xi + i - 1);
+        typename V::type br = *V::at(xr + i);
+        typename V::type bi = *V::at(xi + i);
+        typename V::type dr = ar * br + ai * bi;
+        typename V::type di = ar * bi - ai * br;
+        typename V::type w;
+        atan2_approx(di, dr, w);
+        w *= scale;
+        for (unsigned int k = 0; k < lanes; k++)
+            y[i+k] = w[k];
+    }
+
+    for (; i < n; i++) {
+        y[i] = scale * phase_diff_one(IQSample(xr[i-1], xi[i-1]),
+                                      IQSample(xr[i], xi[i]));
+    }
+}
+
+
+/**
+ * Frequency shift by a group of rotators. If Interleaved is true, xr points
+ * to interleaved IQ samples and xi is not used. Bytes may not exceed the
+ * size of one group of rotators.
+ */
+template <unsigned int Bytes, bool Interleaved>
+static DSP_INLINE void rotate_split_body(const float * xr, const float * xi,
+                                         unsigned int n,
+                                         float * rot_re, float * rot_im,
+                                         float step_re, float step_im,
+                                         float * yr, float * yi)
+{
+    typedef DspVec<float, Bytes> V;
+    typedef DspVec<int32_t, Bytes> M;
+    const unsigned int lanes = V::lanes;
+    const unsigned int nvec = dsp_rotator_lanes / lanes;
+
+    // Masks which select the I and Q values from two interleaved vectors.
+    typename M::type even, odd;
+    for (unsigned int k = 0; k < lanes; k++) {
+        even[k] = 2 * k;
+        odd[k]  = 2 * k + 1;
+    }
+
+    // One group of rotators spans (nvec) vectors.
+    typename V::type rr[nvec], ri[nvec];
+    for (unsigned int v = 0; v < nvec; v++) {
+        rr[v] = *V::at(rot_re + v * lanes);
+        ri[v] = *V::at(rot_im + v * lanes);
+    }
+
+    for (unsigned int j = 0; j < n; j += dsp_rotator_lanes) {
+        for (unsigned int v = 0; v < nvec; v++) {
+            unsigned int i = j + v * lanes;
+            typename V::type a, b;
+            if (Interleaved) {
+                typename V::type p0 = *V::at(xr + 2 * i);
+                typename V::type p1 = *V::at(xr + 2 * i + lanes);
+                a = __builtin_shuffle(p0, p1, even);
+                b = __builtin_shuffle(p0, p1, odd);
+            } else {
+                a = *V::at(xr + i);
+                b = *V::at(xi + i);
+            }
+            *V::at(yr + i) = a * rr[v] - b * ri[v];
+            *V::at(yi + i) = a * ri[v] + b * rr[v];
+            typename V::type t = rr[v] * step_re - ri[v] * step_im;
+            ri[v] = rr[v] * step_im + ri[v] * step_re;
+            rr[v] = t;
+        }
+    }
+
+    for (unsigned int v = 0; v < nvec; v++) {
+        *V::at(rot_re + v * lanes) = rr[v];
+        *V::at(rot_im + v * lanes) = ri[v];
+    }
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void convert_cu8_body(const uint8_t * in, unsigned int n,
+                                        IQSample * out)
+{
+    typedef DspVec<float, Bytes> V;
+    const unsigned int lanes = V::lanes;
+
+    float * p = reinterpret_cast<float *>(out);
+    unsigned int m = 2 * n;
+    unsigned int i = 0;
+    for (; i + lanes <= m; i += lanes) {
+        typename V::type v = __builtin_convertvector(
+            *DspVec<uint8_t, lanes>::at(in + i), typename V::type);
+        *V::at(p + i) = (v - 128.0f) * (1.0f / 128.0f);
+    }
+    for (; i < m; i++)
+        p[i] = (int(in[i]) - 128) * (1.0f / 128.0f);
+}
+
+
+/** Convert one unsigned 8-bit IQ pair with an affine correction. */
+static DSP_INLINE IQSample cu8_corr_one(const uint8_t * in, const float * coef)
+{
+    float a = in[0], b = in[1];
+    return IQSample(coef[0] * a + coef[1], coef[2] * b + coef[3] * a + coef[4]);
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void convert_cu8_corr_body(const uint8_t * in,
+                                             unsigned int n,
+                                             const float * coef,
+                                             IQSample * out, double * stats)
+{
+    typedef DspVec<float, Bytes> V;
+    typedef DspVec<int32_t, Bytes> M;
+    const unsigned int lanes = V::lanes;
+
+    // Gain, cross term and offset per lane of interleaved I/Q values.
+    // The cross term adds a fraction of I to Q.
+    typename V::type ga, gx, off;
+    typename M::type swap;
+    for (unsigned int k = 0; k < lanes; k++) {
+        ga[k]   = (k & 1) ? coef[2] : coef[0];
+        gx[k]   = (k & 1) ? coef[3] : 0;
+        off[k]  = (k & 1) ? coef[4] : coef[1];
+        swap[k] = k ^ 1;
+    }
+
+    // Statistics accumulate in float lanes over short chunks,
+    // then in double precision.
+    const unsigned int chunk = 4096;
+    double sum_re = 0, sum_im = 0, sq_re = 0, sq_im = 0, sum_x = 0;
+
+    float * p = reinterpret_cast<float *>(out);
+    unsigned int m = 2 * n;
+    unsigned int i = 0;
+    while (i + lanes <= m) {
+        unsigned int iend = min(m, i + chunk);
+        typename V::type s1 = { }, s2 = { }, sx = { };
+        for (; i + lanes <= iend; i += lanes) {
+            typename V::type v = __builtin_convertvector(
+                *DspVec<uint8_t, lanes>::at(in + i), typename V::type);
+            typename V::type y = v * ga + __builtin_shuffle(v, swap) * gx + off;
+            *V::at(p + i) = y;
+            s1 += y;
+            s2 += y * y;
+            sx += y * __builtin_shuffle(y, swap);
+        }
+        IQSample a = sum_iq_lanes<Bytes>(s1);
+        IQSample b = sum_iq_lanes<Bytes>(s2);
+        IQSample c = sum_iq_lanes<Bytes>(sx);
+        sum_re += a.real();
+        sum_im += a.imag();
+        sq_re  += b.real();
+        sq_im  += b.imag();
+        sum_x  += c.real();
+    }
+
+    for (; i < m; i += 2) {
+        IQSample y = cu8_corr_one(in + i, coef);
+        out[i/2] = y;
+        sum_re += y.real();
+        sum_im += y.imag();
+        sq_re  += y.real() * y.real();
+        sq_im  += y.imag() * y.imag();
+        sum_x  += y.real() * y.imag();
+    }
+
+    stats[0] += sum_re;
+    stats[1] += sum_im;
+    stats[2] += sq_re;
+    stats[3] += sq_im;
+    stats[4] += sum_x;
+}
+
+
+/** Convert one sample to a signed 16-bit value, clipped to full scale. */
+static DSP_INLINE long s16_one(Sample v, Sample scale)
+{
+    v *= scale;
+    v = (v < -32767) ? -32767 : ((v > 32767) ? 32767 : v);
+    return lrint(v);
+}
+
+
+template <unsigned int Bytes>
+static DSP_INLINE void convert_s16le_body(const Sample * x, unsigned int n,
+                                          Sample gain, uint8_t * out)
+{
+    typedef DspVec<Sample, Bytes> V;
+    const unsigned int lanes = V::lanes;
+    typedef DspVec<int32_t, lanes * 4> I32;
+    typedef DspVec<int16_t, lanes * 2> I16;
+
+    // Adding and subtracting 1.5 * 2**(mantissa bits) rounds to the
+    // nearest integer, ties to even, the same as lrint().
+    // The x86 targets are little-endian, so int16 lanes are stored as is.
+    const Sample scale = gain * 32767;
+    const Sample round = ldexp(Sample(1.5), numeric_limits<Sample>::digits - 1);
+    int16_t * p = reinterpret_cast<int16_t *>(out);
+
+    unsigned int i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        typename V::type v = *V::at(x + i) * scale;
+        v = (v < -32767) ? -32767 : v;
+        v = (v > 32767) ? 32767 : v;
+        v = (v + round) - round;
+        typename I32::type w = __builtin_convertvector(v, typename I32::type);
+        *I16::at(p + i) = __builtin_convertvector(w, typename I16::type);
+    }
+
+    for (; i < n; i++)
+        p[i] = s16_one(x[i], scale);
+}
+
+
+/** Complex multiplication without the NaN/Inf handling of std::complex. */
+static DSP_INLINE complex<Sample> cmul_one(complex<Sample> a,
+                                           complex<Sample> b)
+{
+    return complex<Sample>(a.real() * b.real() - a.imag() * b.imag(),
+                           a.real() * b.imag() + a.imag() * b.real());
+}
+
+
+/** Radix-2 Stockham FFT stage, one complex value at a time. */
+template <bool Inverse>
+static DSP_INLINE void fft_radix2_one(unsigned int len, unsigned int s,
+                                      const complex<Sample> * twiddle,
+                                      const complex<Sample> * x,
+                                      complex<Sample> * y)
+{
+    unsigned int m = len / 2;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<Sample> w = twiddle[p*s];
+        if (Inverse)
+            w = conj(w);
+        const complex<Sample> * x0 = x + s * p;
+        const complex<Sample> * x1 = x + s * (p + m);
+        complex<Sample> * y0 = y + s * (2*p);
+        complex<Sample> * y1 = y + s * (2*p + 1);
+        for (unsigned int q = 0; q < s; q++) {
+            complex<Sample> a = x0[q], b = x1[q];
+            y0[q] = a + b;
+            y1[q] = cmul_one(w, a - b);
+        }
+    }
+}
+
+
+/** Radix-4 Stockham FFT stage, one complex value at a time. */
+template <bool Inverse>
+static DSP_INLINE void fft_radix4_one(unsigned int len, unsigned int s,
+                                      const complex<Sample> * twiddle,
+                                      const complex<Sample> * x,
+                                      complex<Sample> * y)
+{
+    unsigned int m = len / 4;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<Sample> w1 = twiddle[p*s];
+        complex<Sample> w2 = twiddle[2*p*s];
+        complex<Sample> w3 = twiddle[3*p*s];
+        if (Inverse) {
+            w1 = conj(w1);
+            w2 = conj(w2);
+            w3 = conj(w3);
+        }
+        const complex<Sample> * x0 = x + s * p;
+        const complex<Sample> * x1 = x + s * (p + m);
+        const complex<Sample> * x2 = x + s * (p + 2*m);
+        const complex<Sample> * x3 = x + s * (p + 3*m);
+        complex<Sample> * y0 = y + s * (4*p);
+        complex<Sample> * y1 = y + s * (4*p + 1);
+        complex<Sample> * y2 = y + s * (4*p + 2);
+        complex<Sample> * y3 = y + s * (4*p + 3);
+        for (unsigned int q = 0; q < s; q++) {
+            complex<Sample> a = x0[q], b = x1[q], c = x2[q], d = x3[q];
+            complex<Sample> apc = a + c, amc = a - c;
+            complex<Sample> bpd = b + d, bmd = b - d;
+            complex<Sample> jbmd(-bmd.imag(), bmd.real());
+            y0[q] = apc + bpd;
+            y1[q] = cmul_one(w1, Inverse ? (amc + jbmd) : (amc - jbmd));
+            y2[q] = cmul_one(w2, apc - bpd);
+            y3[q] = cmul_one(w3, Inverse ? (amc - jbmd) : (amc + jbmd));
+        }
+    }
+}
+
+
+/**
+ * Helpers for vectors of interleaved complex values (re, im, re, im, ...).
+ * Multiplication by a scalar complex w is
+ *   v * w.re + swap(v) * (-w.im, +w.im, ...)
+ */
+template <unsigned int Bytes>
+struct DspComplexVec
+{
+    typedef DspVec<Sample, Bytes> V;
+    typedef DspVec<typename conditional<sizeof(Sample) == 8,
+                                        int64_t, int32_t>::type, Bytes> M;
+
+    /** Number of complex values per vector. */
+    static constexpr unsigned int lanes = V::lanes / 2;
+
+    typename M::type swap;      // exchanges re and im of each value
+    typename V::type sign;      // (-1, +1, -1, +1, ...)
+
+    DSP_INLINE DspComplexVec()
+    {
+        for (unsigned int k = 0; k < V::lanes; k++) {
+            swap[k] = k ^ 1;
+            sign[k] = (k & 1) ? 1 : -1;
+        }
+    }
+
+    /** Compute r = v * w for a scalar complex w. */
+    DSP_INLINE void mul(const typename V::type& v, complex<Sample> w,
+                        typename V::type& r) const
+    {
+        r = v * w.real() + __builtin_shuffle(v, swap) * (sign * w.imag());
+    }
+
+    /** Compute r = v * j. */
+    DSP_INLINE void mul_j(const typename V::type& v,
+                          typename V::type& r) const
+    {
+        r = __builtin_shuffle(v, swap) * sign;
+    }
+};
+
+
+template <unsigned int Bytes, bool Inverse>
+static DSP_INLINE void fft_radix2_body(unsigned int len, unsigned int s,
+                                       const complex<Sample> * twiddle,
+                                       const complex<Sample> * x,
+                                       complex<Sample> * y)
+{
+    typedef DspComplexVec<Bytes> C;
+    typedef typename C::V V;
+    const unsigned int lanes = C::lanes;
+
+    // Early stages have too short a stride to fill a vector.
+    // The stride is a power of two, so it is a multiple of lanes here.
+    if (s < lanes) {
+        fft_radix2_one<Inverse>(len, s, twiddle, x, y);
+        return;
+    }
+
+    const C cv;
+    unsigned int m = len / 2;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<Sample> w = twiddle[p*s];
+        if (Inverse)
+            w = conj(w);
+        const Sample * x0 = reinterpret_cast<const Sample *>(x + s * p);
+        const Sample * x1 = reinterpret_cast<const Sample *>(x + s * (p + m));
+        Sample * y0 = reinterpret_cast<Sample *>(y + s * (2*p));
+        Sample * y1 = reinterpret_cast<Sample *>(y + s * (2*p + 1));
+        for (unsigned int q = 0; q < 2 * s; q += V::lanes) {
+            typename V::type a = *V::at(x0 + q), b = *V::at(x1 + q);
+            typename V::type r;
+            cv.mul(a - b, w, r);
+            *V::at(y0 + q) = a + b;
+            *V::at(y1 + q) = r;
+        }
+    }
+}
+
+
+template <unsigned int Bytes, bool Inverse>
+static DSP_INLINE void fft_radix4_body(unsigned int len, unsigned int s,
+                                       const complex<Sample> * twiddle,
+                                       const complex<Sample> * x,
+                                       complex<Sample> * y)
+{
+    typedef DspComplexVec<Bytes> C;
+    typedef typename C::V V;
+    const unsigned int lanes = C::lanes;
+
+    if (s < lanes) {
+        fft_radix4_one<Inverse>(len, s, twiddle, x, y);
+        return;
+    }
+
+    const C cv;
+    unsigned int m = len / 4;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<Sample> w1 = twiddle[p*s];
+        complex<Sample> w2 = twiddle[2*p*s];
+        complex<Sample> w3 = twiddle[3*p*s];
+        if (Inverse) {
+            w1 = conj(w1);
+            w2 = conj(w2);
+            w3 = conj(w3);
+        }
+        const Sample * x0 = reinterpret_cast<const Sample *>(x + s * p);
+        const Sample * x1 = reinterpret_cast<const Sample *>(x + s * (p + m));
+        const Sample * x2 = reinterpret_cast<const Sample *>(x + s * (p + 2*m));
+        const Sample * x3 = reinterpret_cast<const Sample *>(x + s * (p + 3*m));
+        Sample * y0 = reinterpret_cast<Sample *>(y + s * (4*p));
+        Sample * y1 = reinterpret_cast<Sample *>(y + s * (4*p + 1));
+        Sample * y2 = reinterpret_cast<Sample *>(y + s * (4*p + 2));
+        Sample * y3 = reinterpret_cast<Sample *>(y + s * (4*p + 3));
+        for (unsigned int q = 0; q < 2 * s; q += V::lanes) {
+            typename V::type a = *V::at(x0 + q), b = *V::at(x1 + q);
+            typename V::type c = *V::at(x2 + q), d = *V::at(x3 + q);
+            typename V::type apc = a + c, amc = a - c;
+            typename V::type bpd = b + d, jbmd, r1, r2, r3;
+            cv.mul_j(b - d, jbmd);
+            cv.mul(Inverse ? (amc + jbmd) : (amc - jbmd), w1, r1);
+            cv.mul(apc - bpd, w2, r2);
+            cv.mul(Inverse ? (amc - jbmd) : (amc + jbmd), w3, r3);
+            *V::at(y0 + q) = apc + bpd;
+            *V::at(y1 + q) = r1;
+            *V::at(y2 + q) = r2;
+            *V::at(y3 + q) = r3;
+        }
+    }
+}
+
+
+/* ****************  generic kernels  **************** */
+
+static Sample dot_generic(const Sample * x, const Sample * c, unsigned int n)
+{
+    Sample y = 0;
+    for (unsigned int i = 0; i < n; i++)
+        y += x[i] * c[i];
+    return y;
+}
+
+static void dot2_generic(const Sample * x, const Sample * a, const Sample * b,
+                         unsigned int n, Sample * ya, Sample * yb)
+{
+    Sample sa = 0, sb = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        sa += x[i] * a[i];
+        sb += x[i] * b[i];
+    }
+    *ya = sa;
+    *yb = sb;
+}
+
+static void fir_decim2_generic(const float * x, unsigned int n,
+                               const float * c, unsigned int taps, float * y)
+{
+    for (unsigned int m = 0; m < n; m++) {
+        float acc = 0;
+        for (unsigned int j = 0; j < taps; j++)
+            acc += c[j] * x[2*m+j];
+        y[m] = acc;
+    }
+}
+
+static void phase_diff_generic(const IQSample * x, unsigned int n,
+                               IQSample prev, float scale, Sample * y)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        y[i] = scale * phase_diff_one(prev, x[i]);
+        prev = x[i];
+    }
+}
+
+static IQSample dot_split_sym_generic(const float * xr, const float * xi,
+                                      const float * c, unsigned int n)
+{
+    unsigned int h = n / 2;
+    float yr = 0, yi = 0;
+    for (unsigned int j = 0; j < h; j++) {
+        yr += (xr[j] + xr[n-1-j]) * c[j];
+        yi += (xi[j] + xi[n-1-j]) * c[j];
+    }
+    if (n & 1) {
+        yr += xr[h] * c[h];
+        yi += xi[h] * c[h];
+    }
+    return IQSample(yr, yi);
+}
+
+static void phase_diff_split_generic(const float * xr, const float * xi,
+                                     unsigned int n, IQSample prev,
+                                     float scale, Sample * y)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        IQSample s(xr[i], xi[i]);
+        y[i] = scale * phase_diff_one(prev, s);
+        prev = s;
+    }
+}
+
+static void rotate_split_generic(const float * xr, const float * xi,
+                                 unsigned int n,
+                                 float * rot_re, float * rot_im,
+                                 float step_re, float step_im,
+                                 float * yr, float * yi)
+{
+    const unsigned int lanes = dsp_rotator_lanes;
+    for (unsigned int j = 0; j < n; j += lanes) {
+        for (unsigned int k = 0; k < lanes; k++) {
+            float a = xr[j+k], b = xi[j+k];
+            float rr = rot_re[k], ri = rot_im[k];
+            yr[j+k] = a * rr - b * ri;
+            yi[j+k] = a * ri + b * rr;
+            rot_re[k] = rr * step_re - ri * step_im;
+            rot_im[k] = rr * step_im + ri * step_re;
+        }
+    }
+}
+
+static void rotate_iq_split_generic(const IQSample * x, unsigned int n,
+                                    float * rot_re, float * rot_im,
+                                    float step_re, float step_im,
+                                    float * yr, float * yi)
+{
+    const unsigned int lanes = dsp_rotator_lanes;
+    for (unsigned int j = 0; j < n; j += lanes) {
+        for (unsigned int k = 0; k < lanes; k++) {
+            float a = x[j+k].real(), b = x[j+k].imag();
+            float rr = rot_re[k], ri = rot_im[k];
+            yr[j+k] = a * rr - b * ri;
+            yi[j+k] = a * ri + b * rr;
+            rot_re[k] = rr * step_re - ri * step_im;
+            rot_im[k] = rr * step_im + ri * step_re;
+        }
+    }
+}
+
+static void convert_cu8_generic(const uint8_t * in, unsigned int n,
+                                IQSample * out)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        out[i] = IQSample((int(in[2*i])   - 128) * (1.0f / 128.0f),
+                          (int(in[2*i+1]) - 128) * (1.0f / 128.0f));
+    }
+}
+
+static void convert_cu8_corr_generic(const uint8_t * in, unsigned int n,
+                                     const float * coef, IQSample * out,
+                                     double * stats)
+{
+    double sum_re = 0, sum_im = 0, sq_re = 0, sq_im = 0, sum_x = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        IQSample y = cu8_corr_one(in + 2 * i, coef);
+        out[i] = y;
+        sum_re += y.real();
+        sum_im += y.imag();
+        sq_re  += y.real() * y.real();
+        sq_im  += y.imag() * y.imag();
+        sum_x  += y.real() * y.imag();
+    }
+    stats[0] += sum_re;
+    stats[1] += sum_im;
+    stats[2] += sq_re;
+    stats[3] += sq_im;
+    stats[4] += sum_x;
+}
+
+static void convert_s16le_generic(const Sample * x, unsigned int n,
+                                  Sample gain, uint8_t * out)
+{
+    const Sample scale = gain * 32767;
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned long u = s16_one(x[i], scale);
+        out[2*i]   = u & 0xff;
+        out[2*i+1] = (u >> 8) & 0xff;
+    }
+}
+
+static void fft_radix2_generic(unsigned int len, unsigned int s,
+                               const complex<Sample> * twiddle,
+                               const complex<Sample> * x,
+                               complex<Sample> * y, bool inverse)
+{
+    if (inverse)
+        fft_radix2_one<true>(len, s, twiddle, x, y);
+    else
+        fft_radix2_one<false>(len, s, twiddle, x, y);
+}
+
+static void fft_radix4_generic(unsigned int len, unsigned int s,
+                               const complex<Sample> * twiddle,
+                               const complex<Sample> * x,
+                               complex<Sample> * y, bool inverse)
+{
+    if (inverse)
+        fft_radix4_one<true>(len, s, twiddle, x, y);
+    else
+        fft_radix4_one<false>(len, s, twiddle, x, y);
+}
+
+static const DspKernels kernels_generic = {
+    DSP_GENERIC, "generic",
+    dot_generic, dot2_generic, dot_split_sym_generic, fir_decim2_generic,
+    phase_diff_generic, phase_diff_split_generic,
+    rotate_split_generic, rotate_iq_split_generic,
+    convert_cu8_generic, convert_cu8_corr_generic, convert_s16le_generic,
+    fft_radix2_generic, fft_radix4_generic
+};
+
+
+/* ****************  x86 SIMD kernels  **************** */
+
+#ifdef DSP_X86
+
+// Define the kernel table for one instruction set level.
+// The rotate kernels use vectors of at most one group of rotators (rbytes).
+#define DSP_DEFINE_KERNELS(lvl, suffix, bytes, rbytes, target_isa)          \
+    __attribute__((target(target_isa)))                                     \
+    static Sample dot_##suffix(const Sample * x, const Sample * c,          \
+                               unsigned int n)                              \
+    {                                                                       \
+        return dot_body<Sample, bytes>(x, c, n);                            \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void dot2_##suffix(const Sample * x, const Sample * a,           \
+                              const Sample * b, unsigned int n,             \
+                              Sample * ya, Sample * yb)                     \
+    {                                                                       \
+        dot2_body<Sample, bytes>(x, a, b, n, ya, yb);                       \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static IQSample dot_split_sym_##suffix(const float * xr,                \
+                                           const float * xi,                \
+                                           const float * c, unsigned int n) \
+    {                                                                       \
+        return dot_split_sym_select<bytes>(xr, xi, c, n);                   \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void fir_decim2_##suffix(const float * x, unsigned int n,        \
+                                    const float * c, unsigned int taps,     \
+                                    float * y)                              \
+    {                                                                       \
+        fir_decim2_body<rbytes>(x, n, c, taps, y);                          \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void phase_diff_##suffix(const IQSample * x, unsigned int n,     \
+                                    IQSample prev, float scale, Sample * y) \
+    {                                                                       \
+        phase_diff_body<bytes>(x, n, prev, scale, y);                       \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void phase_diff_split_##suffix(const float * xr,                 \
+                                          const float * xi, unsigned int n, \
+                                          IQSample prev, float scale,       \
+                                          Sample * y)                       \
+    {                                                                       \
+        phase_diff_split_body<bytes>(xr, xi, n, prev, scale, y);            \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void rotate_split_##suffix(const float * xr, const float * xi,   \
+                                      unsigned int n,                       \
+                                      float * rot_re, float * rot_im,       \
+                                      float step_re, float step_im,         \
+                                      float * yr, float * yi)               \
+    {                                                                       \
+        rotate_split_body<rbytes, false>(xr, xi, n, rot_re, rot_im,         \
+                                         step_re, step_im, yr, yi);         \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void rotate_iq_split_##suffix(const IQSample * x,                \
+                                         unsigned int n,                    \
+                                         float * rot_re, float * rot_im,    \
+                                         float step_re, float step_im,      \
+                                         float * yr, float * yi)            \
+    {                                                                       \
+        const float * p = reinterpret_cast<const float *>(x);               \
+        rotate_split_body<rbytes, true>(p, nullptr, n, rot_re, rot_im,      \
+                                        step_re, step_im, yr, yi);          \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void convert_cu8_##suffix(const uint8_t * in, unsigned int n,    \
+                                     IQSample * out)                        \
+    {                                                                       \
+        convert_cu8_body<bytes>(in, n, out);                                \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void convert_cu8_corr_##suffix(const uint8_t * in,               \
+                                          unsigned int n,                   \
+                                          const float * coef,               \
+                                          IQSample * out, double * stats)   \
+    {                                                                       \
+        convert_cu8_corr_body<bytes>(in, n, coef, out, stats);              \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void convert_s16le_##suffix(const Sample * x, unsigned int n,    \
+                                       Sample gain, uint8_t * out)          \
+    {                                                                       \
+        convert_s16le_body<bytes>(x, n, gain, out);                         \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void fft_radix2_##suffix(unsigned int len, unsigned int s,       \
+                                    const complex<Sample> * twiddle,        \
+                                    const complex<Sample> * x,              \
+                                    complex<Sample> * y, bool inverse)      \
+    {                                                                       \
+        if (inverse)                                                        \
+            fft_radix2_body<bytes, true>(len, s, twiddle, x, y);            \
+        else                                                                \
+            fft_radix2_body<bytes, false>(len, s, twiddle, x, y);           \
+    }                                                                       \
+    __attribute__((target(target_isa)))                                     \
+    static void fft_radix4_##suffix(unsigned int len, unsigned int s,       \
+                                    const complex<Sample> * twiddle,        \
+                                    const complex<Sample> * x,              \
+                                    complex<Sample> * y, bool inverse)      \
+    {                                                                       \
+        if (inverse)                                                        \
+            fft_radix4_body<bytes, true>(len, s, twiddle, x, y);            \
+        else                                                                \
+            fft_radix4_body<bytes, false>(len, s, twiddle, x, y);           \
+    }                                                                       \
+    static const DspKernels kernels_##suffix = {                            \
+        lvl, #suffix,                                                       \
+        dot_##suffix, dot2_##suffix, dot_split_sym_##suffix,                \
+        fir_decim2_##suffix, phase_diff_##suffix,                           \
+        phase_diff_split_##suffix, rotate_split_##suffix,                   \
+        rotate_iq_split_##suffix, convert_cu8_##suffix,                     \
+        convert_cu8_corr_##suffix, convert_s16le_##suffix,                  \
+        fft_radix2_##suffix, fft_radix4_##suffix                            \
+    };
+
+DSP_DEFINE_KERNELS(DSP_SSE2,   sse2,   16, 16, "sse2")
+DSP_DEFINE_KERNELS(DSP_AVX2,   avx2,   32, 32, "avx2,fma")
+DSP_DEFINE_KERNELS(DSP_AVX512, avx512, 64, 32, "avx512f")
+
+#undef DSP_DEFINE_KERNELS
+
+#endif
+
+
+/* ****************  dispatch  **************** */
+
+static atomic<const DspKernels *> active_kernels(nullptr);
+
+
+// Return kernel table for the specified level.
+static const DspKernels * kernel_table(DspLevel level)
+{
+    switch (level) {
+#ifdef DSP_X86
+        case DSP_AVX512:    return &kernels_avx512;
+        case DSP_AVX2:      return &kernels_avx2;
+        case DSP_SSE2:      return &kernels_sse2;
+#endif
+        default:            return &kernels_generic;
+    }
+}
+
+
+// Return the best instruction set level supported by this CPU.
+DspLevel dsp_max_level()
+{
+#ifdef DSP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return DSP_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return DSP_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return DSP_SSE2;
+#endif
+    return DSP_GENERIC;
+}
+
+
+// Return the active kernel table.
+const DspKernels& dsp_kernels()
+{
+    const DspKernels * k = active_kernels.load(memory_order_acquire);
+    if (k != nullptr)
+        return *k;
+
+    // Select the best supported level, unless a lower level is requested
+    // through the environment.
+    DspLevel level = dsp_max_level();
+    const char * env = getenv("SOFTFM_DSP_LEVEL");
+    if (env != nullptr) {
+        for (int i = DSP_GENERIC; i <= level; i++) {
+            if (strcmp(env, kernel_table(DspLevel(i))->name) == 0) {
+                level = DspLevel(i);
+                break;
+            }
+        }
+    }
+
+    const DspKernels * want = kernel_table(level);
+    if (!active_kernels.compare_exchange_strong(k, want))
+        return *k;
+    return *want;
+}
+
+
+// Force an instruction set level.
+bool dsp_set_level(DspLevel level)
+{
+    if (level > dsp_max_level())
+        return false;
+
+    active_kernels.store(kernel_table(level), memory_order_release);
+    return true;
+}
+
+/* end */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTFM_DSPKERNELS_H
+#define SOFTFM_DSPKERNELS_H
+
+#include <cstdint>
+#include "SoftFM.h"
+
+
+/** Instruction set levels for DSP kernels, in order of capability. */
+enum DspLevel { DSP_GENERIC, DSP_SSE2, DSP_AVX2, DSP_AVX512 };
+
+/** Number of parallel rotators of the frequency shift kernels. */
+static constexpr unsigned int dsp_rotator_lanes = 8;
+
+/** Maximum number of coefficients of the fir_decim2 kernel. */
+static constexpr unsigned int dsp_decim2_max_taps = 128;
+
+
+/**
+ *  Table of inner-loop DSP kernels.
+ *
+ *  Every kernel is compiled for each instruction set level. The best level
+ *  supported by the CPU is selected on first use, so a single binary runs
+ *  at full speed on different hosts. The level can be forced with
+ *  dsp_set_level() or with the environment variable SOFTFM_DSP_LEVEL
+ *  (generic, sse2, avx2, avx512).
+ */
+struct DspKernels
+{
+    /** Instruction set level of this table. */
+    DspLevel level;
+
+    /** Name of the instruction set level. */
+    const char * name;
+
+    /** Return sum(x[i] * c[i]) for i = 0 .. n-1. */
+    Sample (*dot)(const Sample * x, const Sample * c, unsigned int n);
+
+    /**
+     * Compute two dot products over the same samples:
+     *   ya = sum(x[i] * a[i]),  yb = sum(x[i] * b[i])  for i = 0 .. n-1
+     */
+    void (*dot2)(const Sample * x, const Sample * a, const Sample * b,
+                 unsigned int n, Sample * ya, Sample * yb);
+
+    /**
+     * Return sum(x[i] * c[i]) for i = 0 .. n-1 with complex samples in
+     * split layout (real parts xr, imaginary parts xi) and symmetric real
+     * coefficients (c[i] == c[n-1-i]). The result is
+     * (sum(xr[i] * c[i]), sum(xi[i] * c[i])).
+     * Pairs of samples with equal coefficients are added before
+     * multiplication, which halves the number of multiplications.
+     * The short filter lengths of DownconverterIQ (11, 65 and 97) are
+     * compiled with a constant length; other lengths use a generic loop.
+     */
+    IQSample (*dot_split_sym)(const IQSample::value_type * xr,
+                              const IQSample::value_type * xi,
+                              const IQSample::value_type * c, unsigned int n);
+
+    /**
+     * FIR filter and decimation by 2 of a real signal x of
+     * (2 * (n - 1) + taps) samples into n outputs:
+     *   y[m] = sum(c[j] * x[2*m+j])  for j = 0 .. taps-1
+     * Zero coefficients are skipped, which makes this efficient for
+     * half-band filters. taps may not exceed dsp_decim2_max_taps.
+     */
+    void (*fir_decim2)(const IQSample::value_type * x, unsigned int n,
+                       const IQSample::value_type * c, unsigned int taps,
+                       IQSample::value_type * y);
+
+    /**
+     * Phase discrimination between successive IQ samples:
+     *   y[i] = scale * arg(conj(x[i-1]) * x[i])  with x[-1] = prev
+     */
+    void (*phase_diff)(const IQSample * x, unsigned int n, IQSample prev,
+                       IQSample::value_type scale, Sample * y);
+
+    /** Same as phase_diff, for samples in split layout. */
+    void (*phase_diff_split)(const IQSample::value_type * xr,
+                             const IQSample::value_type * xi, unsigned int n,
+                             IQSample prev, IQSample::value_type scale,
+                             Sample * y);
+
+    /**
+     * Frequency shift of n samples in split layout, where n is a multiple
+     * of dsp_rotator_lanes:
+     *   y[i] = x[i] * rot[i % lanes]
+     * The rotators (rot_re, rot_im) belong to successive samples of a group
+     * of lanes. Each rotator is multiplied by (step_re, step_im) after every
+     * group, and the final rotators are written back.
+     */
+    void (*rotate_split)(const IQSample::value_type * xr,
+                         const IQSample::value_type * xi, unsigned int n,
+                         IQSample::value_type * rot_re,
+                         IQSample::value_type * rot_im,
+                         IQSample::value_type step_re,
+                         IQSample::value_type step_im,
+                         IQSample::value_type * yr, IQSample::value_type * yi);
+
+    /** Same as rotate_split, for interleaved input samples. */
+    void (*rotate_iq_split)(const IQSample * x, unsigned int n,
+                            IQSample::value_type * rot_re,
+                            IQSample::value_type * rot_im,
+                            IQSample::value_type step_re,
+                            IQSample::value_type step_im,
+                            IQSample::value_type * yr,
+                            IQSample::value_type * yi);
+
+    /** Convert n unsigned 8-bit IQ pairs to IQ samples in range -1 .. +1. */
+    void (*convert_cu8)(const std::uint8_t * in, unsigned int n,
+                        IQSample * out);
+
+    /**
+     * Convert n unsigned 8-bit IQ pairs (a, b) with an affine correction:
+     *   out[i] = (coef[0] * a + coef[1],  coef[2] * b + coef[3] * a + coef[4])
+     * and add statistics of the output samples to stats:
+     *   sum(re), sum(im), sum(re * re), sum(im * im), sum(re * im)
+     */
+    void (*convert_cu8_corr)(const std::uint8_t * in, unsigned int n,
+                             const IQSample::value_type * coef,
+                             IQSample * out, double * stats);
+
+    /**
+     * Convert n samples to signed 16-bit little-endian integers:
+     *   out[i] = lrint(clip(32767 * gain * x[i], -32767, +32767))
+     * out receives 2 * n bytes.
+     */
+    void (*convert_s16le)(const Sample * x, unsigned int n, Sample gain,
+                          std::uint8_t * out);
+
+    /**
+     * Radix-2 Stockham FFT stage of FftPlan<Sample>: transform length len,
+     * stride s, twiddles exp(-2*pi*i*k/n), conjugated if inverse.
+     * Reads len * s values from x and writes them to y.
+     */
+    void (*fft_radix2)(unsigned int len, unsigned int s,
+                       const std::complex<Sample> * twiddle,
+                       const std::complex<Sample> * x,
+                       std::complex<Sample> * y, bool inverse);
+
+    /** Radix-4 Stockham FFT stage, same arguments as fft_radix2. */
+    void (*fft_radix4)(unsigned int len, unsigned int s,
+                       const std::complex<Sample> * twiddle,
+                       const std::complex<Sample> * x,
+                       std::complex<Sample> * y, bool inverse);
+};
+
+
+/** Return the active kernel table. */
+const DspKernels& dsp_kernels();
+
+/** Return the best instruction set level supported by this CPU. */
+DspLevel dsp_max_level();
+
+/**
+ * Force an instruction set level, mainly for testing.
+ * Return false if the CPU does not support the requested level.
+ */
+bool dsp_set_level(DspLevel level);
+
+#endif
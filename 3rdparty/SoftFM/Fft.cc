@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <type_traits>
+
+#include "DspKernels.h"
+#include "Fft.h"
+
+using namespace std;
+
+
+/** Complex multiplication without the NaN/Inf handling of std::complex. */
+template <class T>
+static inline complex<T> cmul(const complex<T>& a, const complex<T>& b)
+{
+    return complex<T>(a.real() * b.real() - a.imag() * b.imag(),
+                      a.real() * b.imag() + a.imag() * b.real());
+}
+
+
+/** Radix-2 Stockham stage: transform length len, stride s. */
+template <class T, bool Inverse>
+static void fft_radix2(unsigned int len, unsigned int s,
+                       const complex<T> * twiddle,
+                       const complex<T> * x, complex<T> * y)
+{
+    unsigned int m = len / 2;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<T> w = twiddle[p*s];
+        if (Inverse)
+            w = conj(w);
+        const complex<T> * x0 = x + s * p;
+        const complex<T> * x1 = x + s * (p + m);
+        complex<T> * y0 = y + s * (2*p);
+        complex<T> * y1 = y + s * (2*p + 1);
+        for (unsigned int q = 0; q < s; q++) {
+            complex<T> a = x0[q], b = x1[q];
+            y0[q] = a + b;
+            y1[q] = cmul(w, a - b);
+        }
+    }
+}
+
+
+/** Radix-4 Stockham stage: transform length len, stride s. */
+template <class T, bool Inverse>
+static void fft_radix4(unsigned int len, unsigned int s,
+                       const complex<T> * twiddle,
+                       const complex<T> * x, complex<T> * y)
+{
+    unsigned int m = len / 4;
+    for (unsigned int p = 0; p < m; p++) {
+        complex<T> w1 = twiddle[p*s];
+        complex<T> w2 = twiddle[2*p*s];
+        complex<T> w3 = twiddle[3*p*s];
+        if (Inverse) {
+            w1 = conj(w1);
+            w2 = conj(w2);
+            w3 = conj(w3);
+        }
+        const complex<T> * x0 = x + s * p;
+        const complex<T> * x1 = x + s * (p + m);
+        const complex<T> * x2 = x + s * (p + 2*m);
+        const complex<T> * x3 = x + s * (p + 3*m);
+        complex<T> * y0 = y + s * (4*p);
+        complex<T> * y1 = y + s * (4*p + 1);
+        complex<T> * y2 = y + s * (4*p + 2);
+        complex<T> * y3 = y + s * (4*p + 3);
+        for (unsigned int q = 0; q < s; q++) {
+            complex<T> a = x0[q], b = x1[q], c = x2[q], d = x3[q];
+            complex<T> apc = a + c, amc = a - c;
+            complex<T> bpd = b + d, bmd = b - d;
+            complex<T> jbmd(-bmd.imag(), bmd.real());
+            y0[q] = apc + bpd;
+            y1[q] = cmul(w1, Inverse ? (amc + jbmd) : (amc - jbmd));
+            y2[q] = cmul(w2, apc - bpd);
+            y3[q] = cmul(w3, Inverse ? (amc - jbmd) : (amc + jbmd));
+        }
+    }
+}
+
+
+/** Run one radix-2 stage, through the DSP kernels for the Sample type. */
+template <class T, bool Inverse>
+static void run_radix2(unsigned int len, unsigned int s,
+                       const complex<T> * twiddle,
+                       const complex<T> * x, complex<T> * y)
+{
+    if (is_same<T, Sample>::value) {
+        dsp_kernels().fft_radix2(
+            len, s, reinterpret_cast<const complex<Sample> *>(twiddle),
+            reinterpret_cast<const complex<Sample> *>(x),
+            reinterpret_cast<complex<Sample> *>(y), Inverse);
+    } else {
+        fft_radix2<T, Inverse>(len, s, twiddle, x, y);
+    }
+}
+
+
+/** Run one radix-4 stage, through the DSP kernels for the Sample type. */
+template <class T, bool Inverse>
+static void run_radix4(unsigned int len, unsigned int s,
+                       const complex<T> * twiddle,
+                       const complex<T> * x, complex<T> * y)
+{
+    if (is_same<T, Sample>::value) {
+        dsp_kernels().fft_radix4(
+            len, s, reinterpret_cast<const complex<Sample> *>(twiddle),
+            reinterpret_cast<const complex<Sample> *>(x),
+            reinterpret_cast<complex<Sample> *>(y), Inverse);
+    } else {
+        fft_radix4<T, Inverse>(len, s, twiddle, x, y);
+    }
+}
+
+
+/* ****************  class FftPlan  **************** */
+
+// Return a cached plan for transforms of size n.
+template <class T>
+shared_ptr<const FftPlan<T>> FftPlan<T>::get(unsigned int n)
+{
+    static mutex cache_mutex;
+    static map<unsigned int, shared_ptr<const FftPlan>> cache;
+
+    unique_lock<mutex> lock(cache_mutex);
+    auto it = cache.find(n);
+    if (it != cache.end())
+        return it->second;
+    lock.unlock();
+
+    // Construct without holding the lock; the constructor needs
+    // the plan of half the size.
+    shared_ptr<const FftPlan> plan(new FftPlan(n));
+
+    lock.lock();
+    return cache.insert(make_pair(n, plan)).first->second;
+}
+
+
+// Construct plan.
+template <class T>
+FftPlan<T>::FftPlan(unsigned int n)
+    : m_n(n)
+    , m_twiddle(n)
+    , m_real_twiddle(n / 2 + 1)
+{
+    assert(n > 0 && (n & (n - 1)) == 0);
+
+    for (unsigned int k = 0; k < n; k++) {
+        double phi = -2.0 * M_PI * k / n;
+        m_twiddle[k] = Complex(cos(phi), sin(phi));
+    }
+
+    if (n >= 2) {
+        for (unsigned int k = 0; k <= n / 2; k++) {
+            double phi = -2.0 * M_PI * k / n;
+            m_real_twiddle[k] = Complex(cos(phi), sin(phi));
+        }
+        m_half = get(n / 2);
+    }
+}
+
+
+// Run all stages of the complex transform.
+template <class T>
+template <bool Inverse>
+void FftPlan<T>::transform(const Complex * in, Complex * out) const
+{
+    static thread_local vector<Complex> work;
+
+    unsigned int n = m_n;
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+
+    // Count stages, so that the last stage writes to the output.
+    unsigned int nstage = 0;
+    for (unsigned int len = n; len > 1; len /= (len >= 4) ? 4 : 2)
+        nstage++;
+
+    work.resize(n);
+    Complex * bufs[2] = { out, work.data() };
+
+    // Stockham stages can not run in-place. If the first stage would
+    // write to the input, move the input out of the way first.
+    const Complex * x = in;
+    if (in == out && (nstage & 1) == 1) {
+        copy(in, in + n, work.begin());
+        x = work.data();
+    }
+
+    unsigned int len = n, s = 1;
+    for (unsigned int k = 0; k < nstage; k++) {
+        Complex * y = bufs[(nstage - 1 - k) & 1];
+        if (len >= 4) {
+            run_radix4<T, Inverse>(len, s, m_twiddle.data(), x, y);
+            len /= 4;
+            s *= 4;
+        } else {
+            run_radix2<T, Inverse>(len, s, m_twiddle.data(), x, y);
+            len /= 2;
+            s *= 2;
+        }
+        x = y;
+    }
+}
+
+
+// Complex forward transform.
+template <class T>
+void FftPlan<T>::forward(const Complex * in, Complex * out) const
+{
+    transform<false>(in, out);
+}
+
+
+// Complex inverse transform.
+template <class T>
+void FftPlan<T>::inverse(const Complex * in, Complex * out) const
+{
+    transform<true>(in, out);
+}
+
+
+// Real forward transform.
+template <class T>
+void FftPlan<T>::forward_real(const T * in, Complex * out) const
+{
+    assert(m_n >= 2);
+    unsigned int h = m_n / 2;
+
+    // Transform even/odd samples as real/imaginary parts of a half-size
+    // complex signal Z, then separate the spectra:
+    //   E[k] = (Z[k] + conj(Z[h-k])) / 2
+    //   O[k] = -j * (Z[k] - conj(Z[h-k])) / 2
+    //   X[k] = E[k] + W^k * O[k],  X[h-k] = conj(E[k]) + W^(h-k) * conj(O[k])
+    m_half->forward(reinterpret_cast<const Complex *>(in), out);
+
+    Complex z0 = out[0];
+    out[0] = Complex(z0.real() + z0.imag(), 0);
+    out[h] = Complex(z0.real() - z0.imag(), 0);
+
+    for (unsigned int k = 1; k <= h / 2; k++) {
+        Complex zk = out[k], zhk = conj(out[h-k]);
+        Complex e = T(0.5) * (zk + zhk);
+        Complex d = T(0.5) * (zk - zhk);
+        Complex o(d.imag(), -d.real());
+        out[k]   = e + cmul(m_real_twiddle[k], o);
+        out[h-k] = conj(e) + cmul(m_real_twiddle[h-k], conj(o));
+    }
+}
+
+
+// Real inverse transform.
+template <class T>
+void FftPlan<T>::inverse_real(const Complex * in, T * out) const
+{
+    assert(m_n >= 2);
+    unsigned int h = m_n / 2;
+
+    // Reverse the separation of forward_real(), without the factor 1/2:
+    //   Z[k] = (X[k] + conj(X[h-k])) + j * W^-k * (X[k] - conj(X[h-k]))
+    Complex * z = reinterpret_cast<Complex *>(out);
+    for (unsigned int k = 0; k < h; k++) {
+        Complex xk = in[k], xhk = conj(in[h-k]);
+        Complex o = cmul(conj(m_real_twiddle[k]), xk - xhk);
+        z[k] = (xk + xhk) + Complex(-o.imag(), o.real());
+    }
+
+    m_half->inverse(z, z);
+}
+
+
+template class FftPlan<float>;
+template class FftPlan<double>;
+
+/* end */
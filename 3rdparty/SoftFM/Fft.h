@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTFM_FFT_H
+#define SOFTFM_FFT_H
+
+#include <complex>
+#include <memory>
+#include <vector>
+
+
+/**
+ *  Fast Fourier transform for power-of-two sizes.
+ *
+ *  The transform is a Stockham auto-sort FFT with radix-4 stages and one
+ *  radix-2 stage for odd powers of two. Each stage runs over contiguous
+ *  memory, so the inner loops vectorize. For T = Sample the stages run
+ *  through the fft_radix2/fft_radix4 kernels of DspKernels, so they use
+ *  the best instruction set of the CPU. Real transforms are computed with
+ *  a complex transform of half the size.
+ *
+ *  Plans are immutable and may be shared between threads.
+ *  Use FftPlan::get() to obtain a plan from the process-wide cache.
+ */
+template <class T>
+class FftPlan
+{
+public:
+    typedef std::complex<T> Complex;
+
+    /** Return a cached plan for transforms of size n (power of two). */
+    static std::shared_ptr<const FftPlan> get(unsigned int n);
+
+    /** Return the transform size. */
+    unsigned int size() const
+    {
+        return m_n;
+    }
+
+    /**
+     * Complex forward transform of n samples:
+     *   out[k] = sum(in[j] * exp(-2*pi*i*j*k/n))
+     *
+     * The input and output may be the same array.
+     */
+    void forward(const Complex * in, Complex * out) const;
+
+    /**
+     * Complex inverse transform of n samples (unscaled):
+     *   out[j] = sum(in[k] * exp(2*pi*i*j*k/n))
+     *
+     * The input and output may be the same array.
+     */
+    void inverse(const Complex * in, Complex * out) const;
+
+    /**
+     * Real forward transform of n real samples into (n/2 + 1) bins.
+     *
+     * The input and output may not overlap.
+     */
+    void forward_real(const T * in, Complex * out) const;
+
+    /**
+     * Inverse of forward_real() (unscaled, result is n times the signal).
+     *
+     * Reads (n/2 + 1) bins, writes n real samples.
+     * The input and output may not overlap.
+     */
+    void inverse_real(const Complex * in, T * out) const;
+
+private:
+    explicit FftPlan(unsigned int n);
+
+    template <bool Inverse>
+    void transform(const Complex * in, Complex * out) const;
+
+    unsigned int            m_n;
+    std::vector<Complex>    m_twiddle;
+    std::vector<Complex>    m_real_twiddle;
+    std::shared_ptr<const FftPlan> m_half;
+};
+
+#endif
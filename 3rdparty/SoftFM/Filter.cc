@@ -41,6 +41,7 @@
 #include <algorithm>
 #include <complex>
 
+#include "DspKernels.h"
 #include "Filter.h"
 
 using namespace std;
@@ -85,20 +86,97 @@ static void make_lanczos_coeff(unsigned int filter_order, double cutoff,
 }
 
 
+/* ****************  class IQCorrector  **************** */
+
+// Definition for uses by reference.
+constexpr double IQCorrector::default_timeconst;
+
+// Construct IQ corrector.
+IQCorrector::IQCorrector(double timeconst)
+    : m_timeconst(timeconst)
+{
+    assert(timeconst > 0);
+    reset();
+}
+
+
+// Forget the current estimates.
+void IQCorrector::reset()
+{
+    m_dc_re = 0;
+    m_dc_im = 0;
+    m_gain  = 1;
+    m_phase = 0;
+}
+
+
+// Convert and correct raw IQ data.
+void IQCorrector::process(const RawSampleVector& samples_in,
+                          IQSampleVector& samples_out)
+{
+    unsigned int n = samples_in.size() / 2;
+    samples_out.resize(n);
+    process(samples_in.data(), n, samples_out.data());
+}
+
+
+// Convert and correct n raw IQ pairs.
+void IQCorrector::process(const uint8_t * samples_in, unsigned int n,
+                          IQSample * samples_out)
+{
+    if (n == 0)
+        return;
+
+    // The raw value v maps to x = v / 128 - 1 - dc.
+    // Output is (x_re, gain * x_im + phase * x_re).
+    const double s = 1.0 / 128;
+    IQSample::value_type coef[5] = {
+        IQSample::value_type(s),
+        IQSample::value_type(-(1 + m_dc_re)),
+        IQSample::value_type(m_gain * s),
+        IQSample::value_type(m_phase * s),
+        IQSample::value_type(-m_gain * (1 + m_dc_im) - m_phase * (1 + m_dc_re))
+    };
+
+    double stats[5] = { 0, 0, 0, 0, 0 };
+    dsp_kernels().convert_cu8_corr(samples_in, n, coef, samples_out, stats);
+
+    // Remaining offset, power and correlation of the corrected samples.
+    double mean_re = stats[0] / n;
+    double mean_im = stats[1] / n;
+    double var_re  = stats[2] / n - mean_re * mean_re;
+    double var_im  = stats[3] / n - mean_im * mean_im;
+    double cov     = stats[4] / n - mean_re * mean_im;
+
+    // Move the correction a step towards the estimate from this block.
+    double mu = 1 - exp(-(n / m_timeconst));
+    m_dc_re += mu * mean_re;
+    m_dc_im += mu * (mean_im - m_phase * mean_re) / m_gain;
+
+    // Skip the imbalance update if there is no signal.
+    if (var_re > 1.0e-12 && var_im > 1.0e-12) {
+        m_phase -= mu * cov / var_re;
+        m_gain  *= pow(var_re / var_im, 0.5 * mu);
+    }
+}
+
+
 /* ****************  class FineTuner  **************** */
 
+// Definition for uses by reference, such as min().
+constexpr unsigned int FineTuner::resync_interval;
+
 // Construct finetuner.
-FineTuner::FineTuner(unsigned int table_size, int freq_shift)
-    : m_index(0)
-    , m_table(table_size)
+FineTuner::FineTuner(double freq_shift)
+    : m_phase(0)
+    , m_phase_step(uint32_t(int64_t(llrint(freq_shift * 4294967296.0))))
 {
-    double phase_step = 2.0 * M_PI / double(table_size);
-    for (unsigned int i = 0; i < table_size; i++) {
-        double phi = (((int64_t)freq_shift * i) % table_size) * phase_step;
-        double pcos = cos(phi);
-        double psin = sin(phi);
-        m_table[i] = IQSample(pcos, psin);
-    }
+    assert(freq_shift >= -0.5 && freq_shift <= 0.5);
+
+    // Rotation over one group of lanes.
+    double phi = lanes * get_freq_shift() * 2.0 * M_PI;
+    m_step_re = cos(phi);
+    m_step_im = sin(phi);
 }
 
 
@@ -106,28 +184,128 @@ FineTuner::FineTuner(unsigned int table_size, int freq_shift)
 void FineTuner::process(const IQSampleVector& samples_in,
                         IQSampleVector& samples_out)
 {
-    unsigned int tblidx = m_index;
-    unsigned int tblsiz = m_table.size();
-    unsigned int n = samples_in.size();
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
 
-    samples_out.resize(n);
 
-    for (unsigned int i = 0; i < n; i++) {
-        samples_out[i] = samples_in[i] * m_table[tblidx];
-        tblidx++;
-        if (tblidx == tblsiz)
-            tblidx = 0;
-    }
+// Process n samples from samples_in to samples_out.
+void FineTuner::process(const IQSample * samples_in, unsigned int n,
+                        IQSample * samples_out)
+{
+    // Access I/Q components as a flat array (guaranteed layout of complex).
+    const T * inp = reinterpret_cast<const T *>(samples_in);
+    T * outp = reinterpret_cast<T *>(samples_out);
+    process_strided<2, 2>(inp, inp + 1, n, outp, outp + 1);
+}
+
 
-    m_index = tblidx; 
+// Process samples in split layout.
+void FineTuner::process(const IQSplitVector& samples_in,
+                        IQSplitVector& samples_out)
+{
+    samples_out.resize(samples_in.size());
+    process(samples_in.re.data(), samples_in.im.data(), samples_in.size(),
+            samples_out.re.data(), samples_out.im.data());
+}
+
+
+// Process n samples in split layout.
+void FineTuner::process(const T * in_re, const T * in_im, unsigned int n,
+                        T * out_re, T * out_im)
+{
+    process_strided<1, 1>(in_re, in_im, n, out_re, out_im);
+}
+
+
+// Process n interleaved samples into split layout.
+void FineTuner::process(const IQSample * samples_in, unsigned int n,
+                        T * out_re, T * out_im)
+{
+    const T * inp = reinterpret_cast<const T *>(samples_in);
+    process_strided<2, 1>(inp, inp + 1, n, out_re, out_im);
+}
+
+
+// Process n samples with strided I/Q components.
+template <unsigned int Sin, unsigned int Sout>
+void FineTuner::process_strided(const T * in_re, const T * in_im,
+                                unsigned int n, T * out_re, T * out_im)
+{
+    static_assert(lanes == dsp_rotator_lanes, "rotator lanes of kernels");
+
+    const DspKernels& kern = dsp_kernels();
+    const double phase_scale = 2.0 * M_PI / 4294967296.0;
+
+    T rot_re[lanes], rot_im[lanes];
+
+    for (unsigned int i = 0; i < n; ) {
+
+        // Re-synchronize rotators with the phase accumulator.
+        // This also corrects amplitude drift of the recurrence.
+        for (unsigned int k = 0; k < lanes; k++) {
+            double phi = uint32_t(m_phase + k * m_phase_step) * phase_scale;
+            rot_re[k] = cos(phi);
+            rot_im[k] = sin(phi);
+        }
+
+        unsigned int nchunk = min(n - i, resync_interval);
+        unsigned int j = 0;
+
+        // Full groups of lanes; each lane advances by the group rotation.
+        // Split output has a SIMD kernel, which also splits interleaved
+        // input on the fly.
+        if (Sout == 1) {
+            j = nchunk - nchunk % lanes;
+            if (Sin == 1) {
+                kern.rotate_split(in_re + i, in_im + i, j, rot_re, rot_im,
+                                  m_step_re, m_step_im,
+                                  out_re + i, out_im + i);
+            } else {
+                const IQSample * x = reinterpret_cast<const IQSample *>(in_re);
+                kern.rotate_iq_split(x + i, j, rot_re, rot_im,
+                                     m_step_re, m_step_im,
+                                     out_re + i, out_im + i);
+            }
+        }
+        for (; j + lanes <= nchunk; j += lanes) {
+            const T * xr = in_re + Sin * (i + j);
+            const T * xi = in_im + Sin * (i + j);
+            T * yr = out_re + Sout * (i + j);
+            T * yi = out_im + Sout * (i + j);
+            for (unsigned int k = 0; k < lanes; k++) {
+                T a = xr[Sin*k], b = xi[Sin*k];
+                T rr = rot_re[k], ri = rot_im[k];
+                yr[Sout*k] = a * rr - b * ri;
+                yi[Sout*k] = a * ri + b * rr;
+                rot_re[k] = rr * m_step_re - ri * m_step_im;
+                rot_im[k] = rr * m_step_im + ri * m_step_re;
+            }
+        }
+
+        // Remaining samples at the end of the block.
+        for (unsigned int k = 0; j + k < nchunk; k++) {
+            T a = in_re[Sin*(i+j+k)], b = in_im[Sin*(i+j+k)];
+            out_re[Sout*(i+j+k)] = a * rot_re[k] - b * rot_im[k];
+            out_im[Sout*(i+j+k)] = a * rot_im[k] + b * rot_re[k];
+        }
+
+        m_phase += nchunk * m_phase_step;
+        i += nchunk;
+    }
 }
 
 
 /* ****************  class LowPassFilterFirIQ  **************** */
 
+// Definition for uses by reference, such as min().
+constexpr unsigned int LowPassFilterFirIQ::chunk_length;
+
 // Construct low-pass filter.
 LowPassFilterFirIQ::LowPassFilterFirIQ(unsigned int filter_order, double cutoff)
-    : m_state(filter_order)
+    : m_order(filter_order)
+    , m_buf_re(filter_order + chunk_length)
+    , m_buf_im(filter_order + chunk_length)
 {
     make_lanczos_coeff(filter_order, cutoff, m_coeff);
 }
@@ -137,77 +315,734 @@ LowPassFilterFirIQ::LowPassFilterFirIQ(unsigned int filter_order, double cutoff)
 void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
                                  IQSampleVector& samples_out)
 {
-    unsigned int order = m_state.size();
-    unsigned int n = samples_in.size();
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
 
-    samples_out.resize(n);
 
-    if (n == 0)
-        return;
+// Process n samples from samples_in to samples_out.
+void LowPassFilterFirIQ::process(const IQSample * samples_in, unsigned int n,
+                                 IQSample * samples_out)
+{
+    // Access I/Q components as a flat array (guaranteed layout of complex).
+    const T * inp = reinterpret_cast<const T *>(samples_in);
+    T * outp = reinterpret_cast<T *>(samples_out);
+    process_strided<2>(inp, inp + 1, n, outp, outp + 1);
+}
 
-    // NOTE: We use m_coeff the wrong way around because it is slightly
-    // faster to scan forward through the array. The result is still correct
-    // because the coefficients are symmetric.
-
-    // The first few samples need data from m_state.
-    unsigned int i = 0;
-    for (; i < n && i < order; i++) {
-        IQSample y = 0;
-        for (unsigned int j = 0; j < order - i; j++)
-            y += m_state[i+j] * m_coeff[j];
-        for (unsigned int j = order - i; j <= order; j++)
-            y += samples_in[i-order+j] * m_coeff[j];
-        samples_out[i] = y;
+
+// Process samples in split layout.
+void LowPassFilterFirIQ::process(const IQSplitVector& samples_in,
+                                 IQSplitVector& samples_out)
+{
+    samples_out.resize(samples_in.size());
+    process(samples_in.re.data(), samples_in.im.data(), samples_in.size(),
+            samples_out.re.data(), samples_out.im.data());
+}
+
+
+// Process n samples in split layout.
+void LowPassFilterFirIQ::process(const T * in_re, const T * in_im,
+                                 unsigned int n, T * out_re, T * out_im)
+{
+    process_strided<1>(in_re, in_im, n, out_re, out_im);
+}
+
+
+// Process n samples with strided I/Q components.
+template <unsigned int Stride>
+void LowPassFilterFirIQ::process_strided(const T * in_re, const T * in_im,
+                                         unsigned int n,
+                                         T * out_re, T * out_im)
+{
+    const DspKernels& kern = dsp_kernels();
+
+    unsigned int order = m_order;
+    T * buf_re = m_buf_re.data();
+    T * buf_im = m_buf_im.data();
+
+    // m_buf_re and m_buf_im hold the last (order) samples of the previous
+    // chunk, followed by the current chunk. Output sample i is the filtered
+    // sample at position (order + i).
+    // NOTE: The coefficients are symmetric, so we can scan them forward.
+
+    for (unsigned int i = 0; i < n; ) {
+
+        unsigned int nchunk = min(n - i, chunk_length);
+
+        // Split the input chunk. Outputs are written after the chunk
+        // has been copied, which makes in-place processing safe.
+        for (unsigned int j = 0; j < nchunk; j++) {
+            buf_re[order+j] = in_re[Stride*(i+j)];
+            buf_im[order+j] = in_im[Stride*(i+j)];
+        }
+
+        for (unsigned int j = 0; j < nchunk; j++) {
+            IQSample y = kern.dot_split_sym(buf_re + j, buf_im + j,
+                                            m_coeff.data(), order + 1);
+            out_re[Stride*(i+j)] = y.real();
+            out_im[Stride*(i+j)] = y.imag();
+        }
+
+        // Keep the last (order) samples as history for the next chunk.
+        copy(buf_re + nchunk, buf_re + nchunk + order, buf_re);
+        copy(buf_im + nchunk, buf_im + nchunk + order, buf_im);
+
+        i += nchunk;
     }
+}
 
-    // Remaining samples only need data from samples_in.
-    for (; i < n; i++) {
-        IQSample y = 0;
-        IQSampleVector::const_iterator inp = samples_in.begin() + i - order;
-        for (unsigned int j = 0; j <= order; j++)
-            y += inp[j] * m_coeff[j];
-        samples_out[i] = y;
+
+/* ****************  class HalfBandDecimator  **************** */
+
+// Definitions for uses by reference, such as min().
+constexpr unsigned int HalfBandDecimator::side_taps;
+constexpr double HalfBandDecimator::passband;
+
+/** Modified Bessel function of the first kind of order 0. */
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50 && term > 1.0e-12 * sum; k++) {
+        double t = x / (2 * k);
+        term *= t * t;
+        sum += term;
     }
+    return sum;
+}
 
-    // Update m_state.
-    if (n < order) {
-        copy(m_state.begin() + n, m_state.end(), m_state.begin());
-        copy(samples_in.begin(), samples_in.end(), m_state.end() - n);
-    } else {
-        copy(samples_in.end() - order, samples_in.end(), m_state.begin());
+
+// Construct half-band decimator.
+HalfBandDecimator::HalfBandDecimator(unsigned int max_input)
+    : m_max_input(max_input)
+    , m_len(4 * side_taps - 2)
+    , m_coeff(4 * side_taps - 1)
+    , m_buf_re(4 * side_taps - 2 + max_input)
+    , m_buf_im(4 * side_taps - 2 + max_input)
+{
+    static_assert(4 * side_taps - 1 <= dsp_decim2_max_taps, "too many taps");
+
+    // Prepare Kaiser-windowed sinc filter with cutoff at 1/4.
+    //   t[i]     =  (i - 2 * K + 1)
+    //   coeff[i] =  Sinc(t[i] / 2) * I0(beta * sqrt(1 - (t[i]/(2*K))^2))
+    //   coeff    /= sum(coeff)
+    // The taps at even, non-zero t[i] are exactly zero.
+    const int center = 2 * side_taps - 1;
+    const double beta = 9.0;
+    double ysum = 0.0;
+    vector<double> y(m_coeff.size());
+    for (int i = 0; i < (int)m_coeff.size(); i++) {
+        int t = i - center;
+        if (t == 0) {
+            y[i] = 1.0;
+        } else if (t % 2 == 0) {
+            y[i] = 0.0;
+        } else {
+            double r = t / double(2 * side_taps);
+            double x = 0.5 * M_PI * t;
+            y[i] = sin(x) / x *
+                   bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+        }
+        ysum += y[i];
+    }
+
+    for (unsigned int i = 0; i < m_coeff.size(); i++)
+        m_coeff[i] = y[i] / ysum;
+}
+
+
+// Return the number of output samples for the next n input samples.
+unsigned int HalfBandDecimator::get_output_size(unsigned int n) const
+{
+    return (m_len + n + 3 - 4 * side_taps) / 2;
+}
+
+
+// Process n samples in split layout.
+unsigned int HalfBandDecimator::process(const T * in_re, const T * in_im,
+                                        unsigned int n,
+                                        T * out_re, T * out_im)
+{
+    assert(n <= m_max_input);
+
+    const DspKernels& kern = dsp_kernels();
+
+    // m_buf_re and m_buf_im hold at least (4 * side_taps - 3) samples
+    // of history, followed by the current input.
+    // NOTE: All input is copied before any output is written,
+    //       so in-place processing is safe.
+    T * buf_re = m_buf_re.data();
+    T * buf_im = m_buf_im.data();
+    copy(in_re, in_re + n, buf_re + m_len);
+    copy(in_im, in_im + n, buf_im + m_len);
+    m_len += n;
+
+    unsigned int n_out = (m_len + 3 - 4 * side_taps) / 2;
+    kern.fir_decim2(buf_re, n_out, m_coeff.data(), m_coeff.size(), out_re);
+    kern.fir_decim2(buf_im, n_out, m_coeff.data(), m_coeff.size(), out_im);
+
+    // Keep the samples that are still needed as history.
+    copy(buf_re + 2 * n_out, buf_re + m_len, buf_re);
+    copy(buf_im + 2 * n_out, buf_im + m_len, buf_im);
+    m_len -= 2 * n_out;
+
+    return n_out;
+}
+
+
+/* ****************  class DownconverterIQ  **************** */
+
+// Definition for uses by reference, such as min().
+constexpr unsigned int DownconverterIQ::chunk_length;
+
+// Construct downconverter.
+DownconverterIQ::DownconverterIQ(double freq_shift, unsigned int filter_order,
+                                 double cutoff, unsigned int downsample)
+    : m_downsample(downsample)
+    , m_order(filter_order)
+    , m_final_downsample(downsample)
+    , m_pos(0)
+    , m_finetuner(freq_shift)
+{
+    assert(downsample >= 1);
+
+    // Split off factors of 2 by half-band stages.
+    unsigned int stages = count_halfband_stages(cutoff, downsample);
+    while (m_halfband.size() < stages) {
+        m_halfband.emplace_back(chunk_length >> m_halfband.size());
+        m_final_downsample /= 2;
+        m_order /= 2;
+        cutoff *= 2;
+    }
+
+    m_buf_re.resize(m_order + chunk_length);
+    m_buf_im.resize(m_order + chunk_length);
+
+    make_lanczos_coeff(m_order, cutoff, m_coeff);
+}
+
+
+// Return the number of half-band stages for a downconverter.
+unsigned int DownconverterIQ::count_halfband_stages(double cutoff,
+                                                    unsigned int downsample)
+{
+    // Take factors of 2 by half-band stages while the wanted band fits
+    // in their passband and at least a factor of 2 is left for the FIR.
+    // For a factor such as 12 = 2 * 2 * 3 the FIR then decimates by the
+    // odd part at a quarter of the input rate with a quarter of the taps.
+    unsigned int stages = 0;
+    while (downsample % 2 == 0 && downsample >= 4 &&
+           cutoff <= HalfBandDecimator::passband) {
+        stages++;
+        downsample /= 2;
+        cutoff *= 2;
+    }
+    return stages;
+}
+
+
+// Return the group delay of the filters.
+double DownconverterIQ::get_delay() const
+{
+    // Each stage delays by its own delay times its input decimation.
+    double delay = 0;
+    unsigned int scale = 1;
+    for (const HalfBandDecimator& hb : m_halfband) {
+        delay += hb.get_delay() * scale;
+        scale *= 2;
     }
+    return delay + 0.5 * m_order * scale;
+}
+
+
+// Return the number of output samples for the next n input samples.
+unsigned int DownconverterIQ::get_output_size(unsigned int n) const
+{
+    for (const HalfBandDecimator& hb : m_halfband)
+        n = hb.get_output_size(n);
+    return (m_pos < n) ?
+           (n - m_pos + m_final_downsample - 1) / m_final_downsample : 0;
+}
+
+
+// Process samples.
+void DownconverterIQ::process(const IQSampleVector& samples_in,
+                              IQSampleVector& samples_out)
+{
+    samples_out.resize(get_output_size(samples_in.size()));
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
+
+
+// Process n samples and return the number of output samples.
+unsigned int DownconverterIQ::process(const IQSample * samples_in,
+                                      unsigned int n, IQSample * samples_out)
+{
+    T * outp = reinterpret_cast<T *>(samples_out);
+    return process_strided<2>(samples_in, n, outp, outp + 1);
+}
+
+
+// Process samples into split layout.
+void DownconverterIQ::process(const IQSampleVector& samples_in,
+                              IQSplitVector& samples_out)
+{
+    samples_out.resize(get_output_size(samples_in.size()));
+    process(samples_in.data(), samples_in.size(),
+            samples_out.re.data(), samples_out.im.data());
+}
+
+
+// Process n samples into split layout.
+unsigned int DownconverterIQ::process(const IQSample * samples_in,
+                                      unsigned int n, T * out_re, T * out_im)
+{
+    return process_strided<1>(samples_in, n, out_re, out_im);
+}
+
+
+// Process n samples with strided I/Q components of the output.
+template <unsigned int Stride>
+unsigned int DownconverterIQ::process_strided(const IQSample * samples_in,
+                                              unsigned int n,
+                                              T * out_re, T * out_im)
+{
+    const DspKernels& kern = dsp_kernels();
+
+    unsigned int order = m_order;
+    unsigned int pstep = m_final_downsample;
+    unsigned int n_out = get_output_size(n);
+    T * buf_re = m_buf_re.data();
+    T * buf_im = m_buf_im.data();
+
+    // m_buf_re and m_buf_im hold the last (order) frequency-shifted samples
+    // of the previous chunk, followed by the frequency-shifted current chunk.
+    // Output sample p is the filtered sample at position (order + p).
+    // NOTE: The coefficients are symmetric, so we can scan them forward
+    //       and fold pairs of samples with equal coefficients.
+
+    unsigned int k = 0;
+    for (unsigned int i = 0; i < n; ) {
+
+        unsigned int nchunk = min(n - i, chunk_length);
+        uint64_t t = StageCounters::now();
+        // NOTE: Outputs are written after the input chunk has been
+        //       consumed, and never run ahead of the input position.
+        //       This makes in-place processing safe.
+        m_finetuner.process(samples_in + i, nchunk,
+                            buf_re + order, buf_im + order);
+        i += nchunk;
+        t = m_stage_counters.add(STAGE_FINETUNER, t, nchunk);
+
+        // Decimate in place through the half-band stages.
+        if (!m_halfband.empty()) {
+            unsigned int nhb = nchunk;
+            for (HalfBandDecimator& hb : m_halfband)
+                nchunk = hb.process(buf_re + order, buf_im + order, nchunk,
+                                    buf_re + order, buf_im + order);
+            t = m_stage_counters.add(STAGE_HALFBAND, t, nhb);
+        }
+
+        unsigned int p = m_pos;
+        if (Stride == 1 && pstep == 2 && p < nchunk) {
+            // Compute a whole chunk of outputs at a time.
+            unsigned int m = (nchunk - p + 1) / 2;
+            kern.fir_decim2(buf_re + p, m, m_coeff.data(), order + 1,
+                            out_re + k);
+            kern.fir_decim2(buf_im + p, m, m_coeff.data(), order + 1,
+                            out_im + k);
+            p += 2 * m;
+            k += m;
+        }
+        for (; p < nchunk; p += pstep, k++) {
+            IQSample y = kern.dot_split_sym(buf_re + p, buf_im + p,
+                                            m_coeff.data(), order + 1);
+            out_re[Stride*k] = y.real();
+            out_im[Stride*k] = y.imag();
+        }
+
+        m_pos = p - nchunk;
+
+        // Keep the last (order) samples as history for the next chunk.
+        copy(buf_re + nchunk, buf_re + nchunk + order, buf_re);
+        copy(buf_im + nchunk, buf_im + nchunk + order, buf_im);
+        m_stage_counters.add(STAGE_IF_FILTER, t, nchunk);
+    }
+
+    assert(k == n_out);
+    return n_out;
+}
+
+
+/* ****************  fixed-point helpers  **************** */
+
+// Return table of Q14 sine values covering one full period.
+const int16_t * fixed_sine_table()
+{
+    static const vector<int16_t> table = [] {
+        unsigned int n = 1U << fixed_sine_bits;
+        vector<int16_t> t(n);
+        for (unsigned int i = 0; i < n; i++) {
+            t[i] = lrint(sin(2.0 * M_PI * i / n) * (1 << fixed_frac_bits));
+        }
+        return t;
+    }();
+
+    return table.data();
+}
+
+
+/* ****************  class DownconverterFixed  **************** */
+
+// Definition for uses by reference, such as min().
+constexpr unsigned int DownconverterFixed::chunk_length;
+
+// Construct fixed-point downconverter.
+DownconverterFixed::DownconverterFixed(double freq_shift,
+                                       unsigned int filter_order,
+                                       double cutoff,
+                                       unsigned int downsample)
+    : m_order(filter_order)
+    , m_downsample(downsample)
+    , m_pos(0)
+    , m_phase(0)
+    , m_phase_step(uint32_t(int64_t(llrint(freq_shift * 4294967296.0))))
+    , m_coeff(filter_order + 1)
+    , m_buf(2 * (filter_order + chunk_length))
+{
+    assert(freq_shift >= -0.5 && freq_shift <= 0.5);
+    assert(downsample >= 1);
+
+    vector<double> coeff;
+    make_lanczos_coeff(filter_order, cutoff, coeff);
+    for (unsigned int i = 0; i <= filter_order; i++) {
+        m_coeff[i] = lrint(coeff[i] * (1 << fixed_frac_bits));
+    }
+}
+
+
+// Process samples.
+void DownconverterFixed::process(const RawSampleVector& samples_in,
+                                 IQSample16Vector& samples_out)
+{
+    const int16_t * sintab = fixed_sine_table();
+    const unsigned int tshift = 32 - fixed_sine_bits;
+    const unsigned int tquarter = 1U << (fixed_sine_bits - 2);
+    const unsigned int tmask = (1U << fixed_sine_bits) - 1;
+
+    unsigned int order = m_order;
+    unsigned int pstep = m_downsample;
+    unsigned int n = samples_in.size() / 2;
+
+    samples_out.resize((m_pos < n) ? (n - m_pos + pstep - 1) / pstep : 0);
+
+    // m_buf holds interleaved I/Q values: the last (order) frequency-shifted
+    // samples of the previous chunk, followed by the current chunk.
+    const uint8_t * inp = samples_in.data();
+    const int16_t * coeff = m_coeff.data();
+    int16_t * buf = m_buf.data();
+
+    unsigned int k = 0;
+    for (unsigned int i = 0; i < n; ) {
+
+        unsigned int nchunk = min(n - i, chunk_length);
+        uint64_t ts = StageCounters::now();
+
+        // Frequency shift. Q7 input times Q14 oscillator gives Q21.
+        const uint8_t * x = inp + 2 * i;
+        int16_t * t = buf + 2 * order;
+        uint32_t phase = m_phase;
+        for (unsigned int j = 0; j < nchunk; j++) {
+            int32_t xr = int32_t(x[2*j]) - 128;
+            int32_t xi = int32_t(x[2*j+1]) - 128;
+            unsigned int idx = phase >> tshift;
+            int32_t ps = sintab[idx];
+            int32_t pc = sintab[(idx + tquarter) & tmask];
+            t[2*j]   = int16_t((xr * pc - xi * ps) >> 7);
+            t[2*j+1] = int16_t((xr * ps + xi * pc) >> 7);
+            phase += m_phase_step;
+        }
+        m_phase = phase;
+        ts = m_stage_counters.add(STAGE_FINETUNER, ts, nchunk);
+
+        // Low-pass filter and decimate. Q14 times Q14 gives Q28.
+        unsigned int p = m_pos;
+        for (; p < nchunk; p += pstep, k++) {
+            const int16_t * w = buf + 2 * p;
+            int32_t yr = 0, yi = 0;
+            for (unsigned int j = 0; j <= order; j++) {
+                yr += w[2*j]   * coeff[j];
+                yi += w[2*j+1] * coeff[j];
+            }
+            samples_out[k].re = fixed_round_sat(yr, fixed_frac_bits);
+            samples_out[k].im = fixed_round_sat(yi, fixed_frac_bits);
+        }
+
+        m_pos = p - nchunk;
+
+        // Keep the last (order) samples as history for the next chunk.
+        copy(m_buf.begin() + 2 * nchunk,
+             m_buf.begin() + 2 * (nchunk + order),
+             m_buf.begin());
+        m_stage_counters.add(STAGE_IF_FILTER, ts, nchunk);
+
+        i += nchunk;
+    }
+
+    assert(k == samples_out.size());
 }
 
 
 /* ****************  class DownsampleFilter  **************** */
 
+/** Return sum(x[j * stride] * c[j]) for j = 0 .. n-1. */
+static inline Sample dot_stride(const Sample * x, unsigned int stride,
+                                const Sample * c, unsigned int n)
+{
+    Sample y = 0;
+    for (unsigned int j = 0; j < n; j++)
+        y += x[j * stride] * c[j];
+    return y;
+}
+
+
 // Construct low-pass filter with optional downsampling.
 DownsampleFilter::DownsampleFilter(unsigned int filter_order, double cutoff,
-                                   double downsample, bool integer_factor)
-    : m_downsample(downsample)
+                                   double downsample, bool integer_factor,
+                                   unsigned int channels)
+    : m_order(filter_order)
+    , m_channels(channels)
+    , m_downsample(downsample)
     , m_downsample_int(integer_factor ? lrint(downsample) : 0)
+    , m_up(0)
+    , m_down(0)
     , m_pos_int(0)
+    , m_phase(0)
     , m_pos_frac(0)
-    , m_state(filter_order)
+    , m_state(filter_order * channels)
 {
     assert(downsample >= 1);
     assert(filter_order > 1);
+    assert(channels >= 1);
+
+    if (!integer_factor && !find_rational(downsample, m_up, m_down)) {
+        m_up = 0;
+        m_down = 0;
+    }
+
+    // Force the first coefficient to zero and append an extra zero at the
+    // end of the array. This ensures we can always obtain (filter_order+1)
+    // coefficients by linear interpolation between adjacent array elements.
+    make_lanczos_coeff(filter_order - 1, cutoff, m_coeff);
+    m_coeff.insert(m_coeff.begin(), 0);
+    m_coeff.push_back(0);
+
+    // Keep a reversed copy to compute outputs as forward dot products.
+    m_coeff_rev.assign(m_coeff.rbegin(), m_coeff.rend());
+
+    // Switch to FFT convolution if the direct filter is too expensive.
+    if (prefers_fft(filter_order, downsample, integer_factor, channels)) {
+
+        // Overlap-save blocks of at least 3 times the filter length.
+        unsigned int fft_size = 2;
+        while (fft_size < 4 * (filter_order + 1))
+            fft_size *= 2;
+        m_fft = FftPlan<Sample>::get(fft_size);
+
+        // Transform the impulse response m_coeff[1 .. filter_order+1].
+        // Include the 1/fft_size scaling of the inverse transform.
+        m_fft_buf.assign(fft_size, 0);
+        for (unsigned int j = 0; j <= filter_order; j++)
+            m_fft_buf[j] = m_coeff[j+1] / Sample(fft_size);
+
+        if (channels == 1) {
+            m_fft_filter.resize(fft_size / 2 + 1);
+            m_fft->forward_real(m_fft_buf.data(), m_fft_filter.data());
+            m_fft_spectrum.resize(fft_size / 2 + 1);
+        } else {
+            m_fft_filter.assign(m_fft_buf.begin(), m_fft_buf.end());
+            m_fft->forward(m_fft_filter.data(), m_fft_filter.data());
+            m_fft_spectrum.resize(fft_size);
+        }
+
+        m_fft_conv.assign(channels, 0);
+
+    } else if (m_up != 0) {
+
+        // Interpolated coefficients in reversed order for each phase
+        // (ph / m_up) between input samples:
+        //   m_coeff_phase[ph*(order+1)+t] = m_coeff_rev[t+1] * (1 - k)
+        //                                   + m_coeff_rev[t] * k
+        unsigned int taps = filter_order + 1;
+        m_coeff_phase.resize(m_up * taps);
+        for (unsigned int ph = 0; ph < m_up; ph++) {
+            double k = ph / double(m_up);
+            for (unsigned int t = 0; t < taps; t++) {
+                m_coeff_phase[ph*taps+t] = (1 - k) * m_coeff_rev[t+1]
+                                           + k * m_coeff_rev[t];
+            }
+        }
+
+    } else if (channels > 1 && m_downsample_int == 0) {
+
+        // Interpolated coefficients, shared by all channels.
+        m_coeff_interp.resize(filter_order + 1);
+    }
+}
+
+
+// Decide between FFT convolution and the direct-form filter.
+bool DownsampleFilter::prefers_fft(unsigned int filter_order,
+                                   double downsample, bool integer_factor,
+                                   unsigned int channels)
+{
+    // The fractional algorithm needs two multiplications per tap.
+    // Count the multiplications for all channels: the direct filter
+    // handles interleaved channels with strided dot products, while
+    // FFT convolution transforms two channels at once.
+    unsigned int up, down;
+    unsigned int nmul = integer_factor ? filter_order
+                      : find_rational(downsample, up, down) ? filter_order + 1
+                      : 2 * (filter_order + 1);
+    return nmul * channels > fft_crossover * downsample;
+}
+
+
+// Find a rational representation of the downsample factor.
+bool DownsampleFilter::find_rational(double downsample,
+                                     unsigned int& up, unsigned int& down)
+{
+    for (unsigned int u = 1; u <= max_phases; u++) {
+        double d = downsample * u;
+        if (fabs(d - lrint(d)) < 1.0e-9 * d) {
+            up = u;
+            down = lrint(d);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Return the maximum number of output frames for n input frames.
+unsigned int DownsampleFilter::get_max_output_size(unsigned int n) const
+{
+    if (m_downsample_int != 0)
+        return (n - m_pos_int + m_downsample_int - 1) / m_downsample_int;
+    else if (m_up != 0)
+        return (m_pos_int < n) ?
+               ((n - m_pos_int) * m_up - m_phase + m_down - 1) / m_down : 0;
+    else
+        return int(2 + n / m_downsample);
+}
+
+
+// Process samples.
+void DownsampleFilter::process(const SampleVector& samples_in,
+                               SampleVector& samples_out)
+{
+    unsigned int n = samples_in.size() / m_channels;
+    samples_out.resize(get_max_output_size(n) * m_channels);
+    unsigned int n_out = process(samples_in.data(), n, samples_out.data());
+    samples_out.resize(n_out * m_channels);
+}
+
+
+// Process n frames and return the number of output frames.
+unsigned int DownsampleFilter::process(const Sample * samples_in,
+                                       unsigned int n, Sample * samples_out)
+{
+    unsigned int n_out;
+
+    if (m_fft) {
+        n_out = process_fft(samples_in, n, samples_out, m_channels);
+    } else if (m_channels == 1) {
+        n_out = process_direct(samples_in, n, samples_out);
+    } else {
+        n_out = process_direct_multi(samples_in, n, samples_out);
+    }
+
+    // Update m_state.
+    unsigned int len = m_order * m_channels;
+    if (n < m_order) {
+        unsigned int k = n * m_channels;
+        copy(m_state.begin() + k, m_state.end(), m_state.begin());
+        copy(samples_in, samples_in + k, m_state.end() - k);
+    } else {
+        copy(samples_in + n * m_channels - len, samples_in + n * m_channels,
+             m_state.begin());
+    }
+
+    return n_out;
+}
+
+
+// Process n samples of the first channel only.
+unsigned int DownsampleFilter::process_first(const Sample * samples_in,
+                                             unsigned int n,
+                                             Sample * samples_out)
+{
+    if (m_channels == 1)
+        return process(samples_in, n, samples_out);
+
+    unsigned int n_out;
+
+    if (m_fft) {
+        n_out = process_fft(samples_in, n, samples_out, 1);
+    } else {
+        n_out = process_direct(samples_in, n, samples_out);
+    }
+
+    // Update channel 0 of m_state.
+    unsigned int order = m_order;
+    unsigned int nch = m_channels;
+    for (unsigned int t = 0; t < order; t++) {
+        m_state[t*nch] = (t + n >= order) ? samples_in[t+n-order]
+                                          : m_state[(t+n)*nch];
+    }
+
+    return n_out;
+}
+
+
+// Replace the input history of one channel.
+void DownsampleFilter::set_history(unsigned int channel,
+                                   const Sample * samples, unsigned int n)
+{
+    assert(channel < m_channels);
 
-    // Force the first coefficient to zero and append an extra zero at the
-    // end of the array. This ensures we can always obtain (filter_order+1)
-    // coefficients by linear interpolation between adjacent array elements.
-    make_lanczos_coeff(filter_order - 1, cutoff, m_coeff);
-    m_coeff.insert(m_coeff.begin(), 0);
-    m_coeff.push_back(0);
+    unsigned int order = m_order;
+    unsigned int nch = m_channels;
+    for (unsigned int t = 0; t < order; t++) {
+        m_state[t*nch+channel] = (t + n >= order) ? samples[t+n-order]
+                                                  : m_state[(t+n)*nch+channel];
+    }
+
+    if (m_fft) {
+        // Recompute the filter output at the last input position,
+        // which process_fft() carries over to the next block.
+        //   y = sum(m_coeff[j] * x[-j])  for j = 1 .. order
+        Sample y = 0;
+        for (unsigned int j = 1; j <= order; j++)
+            y += m_coeff[j] * m_state[(order-j)*nch+channel];
+        if (m_fft_conv.size() < nch)
+            m_fft_conv.resize(nch);
+        m_fft_conv[channel] = y;
+    }
 }
 
 
-// Process samples.
-void DownsampleFilter::process(const SampleVector& samples_in,
-                               SampleVector& samples_out)
+// Filter and decimate the first channel directly.
+unsigned int DownsampleFilter::process_direct(const Sample * samples_in,
+                                              unsigned int n,
+                                              Sample * samples_out)
 {
-    unsigned int order = m_state.size();
-    unsigned int n = samples_in.size();
+    const DspKernels& kern = dsp_kernels();
+
+    // Channel 0 of the interleaved m_state holds the history.
+    unsigned int order = m_order;
+    unsigned int nch = m_channels;
+    unsigned int n_out;
 
     if (m_downsample_int != 0) {
 
@@ -217,7 +1052,7 @@ void DownsampleFilter::process(const SampleVector& samples_in,
         unsigned int p = m_pos_int;
         unsigned int pstep = m_downsample_int;
 
-        samples_out.resize((n - p + pstep - 1) / pstep);
+        n_out = (n - p + pstep - 1) / pstep;
 
         // The first few samples need data from m_state.
         unsigned int i = 0;
@@ -226,48 +1061,94 @@ void DownsampleFilter::process(const SampleVector& samples_in,
             for (unsigned int j = 1; j <= p; j++)
                 y += samples_in[p-j] * m_coeff[j];
             for (unsigned int j = p + 1; j <= order; j++)
-                y += m_state[order+p-j] * m_coeff[j];
+                y += m_state[(order+p-j)*nch] * m_coeff[j];
             samples_out[i] = y;
         }
 
         // Remaining samples only need data from samples_in.
+        //   y = sum(samples_in[p-j] * m_coeff[j])  for j = 1 .. order
         for (; p < n; p += pstep, i++) {
-            Sample y = 0;
-            for (unsigned int j = 1; j <= order; j++)
-                y += samples_in[p-j] * m_coeff[j];
-            samples_out[i] = y;
+            samples_out[i] = kern.dot(samples_in + p - order,
+                                      m_coeff_rev.data() + 1, order);
         }
 
-        assert(i == samples_out.size());
+        assert(i == n_out);
 
         // Update index of start position in text sample block.
         m_pos_int = p - n;
 
+    } else if (m_up != 0) {
+
+        // Rational downsample factor (m_down / m_up). Output positions
+        // fall on m_up phases between input samples, and each phase has
+        // a precomputed set of interpolated coefficients.
+        unsigned int taps = order + 1;
+        unsigned int pi = m_pos_int;
+        unsigned int ph = m_phase;
+
+        unsigned int i = 0;
+        while (pi < n) {
+            const Sample * kr = m_coeff_phase.data() + ph * taps;
+            Sample y;
+            if (pi >= order) {
+                y = kern.dot(samples_in + pi - order, kr, taps);
+            } else {
+                // Channel 0 of m_state holds the history.
+                y = 0;
+                for (unsigned int t = 0; t <= order; t++) {
+                    Sample s = (pi + t >= order) ? samples_in[pi+t-order]
+                                                 : m_state[(pi+t)*nch];
+                    y += s * kr[t];
+                }
+            }
+            samples_out[i++] = y;
+
+            ph += m_down;
+            pi += ph / m_up;
+            ph %= m_up;
+        }
+
+        n_out = i;
+
+        // Update position of the next output in the next sample block.
+        m_pos_int = pi - n;
+        m_phase = ph;
+
     } else {
 
         // Fractional downsample factor via linear interpolation of
         // the FIR coefficient table. This is a bitch.
 
         // Estimate number of output samples we can produce in this run.
-        Sample p = m_pos_frac;
-        Sample pstep = m_downsample;
-        unsigned int n_out = int(2 + n / pstep);
-
-        samples_out.resize(n_out);
+        // Track the position in double precision, even if Sample is float.
+        double p = m_pos_frac;
+        double pstep = m_downsample;
+        unsigned int n_max = int(2 + n / pstep);
 
         // Produce output samples.
         unsigned int i = 0;
-        Sample pf = p;
+        double pf = p;
         unsigned int pi = int(pf);
         while (pi < n) {
-            Sample k1 = pf - pi;
+            Sample k1 = Sample(pf - pi);
             Sample k0 = 1 - k1;
 
             Sample y = 0;
-            for (unsigned int j = 0; j <= order; j++) {
-                Sample k = m_coeff[j] * k0 + m_coeff[j+1] * k1;
-                Sample s = (j <= pi) ? samples_in[pi-j] : m_state[order+pi-j];
-                y += k * s;
+            if (pi >= order) {
+                // Interpolating between adjacent coefficients equals
+                // interpolating between two dot products.
+                Sample y0, y1;
+                kern.dot2(samples_in + pi - order,
+                          m_coeff_rev.data() + 1, m_coeff_rev.data(),
+                          order + 1, &y0, &y1);
+                y = k0 * y0 + k1 * y1;
+            } else {
+                for (unsigned int j = 0; j <= order; j++) {
+                    Sample k = m_coeff[j] * k0 + m_coeff[j+1] * k1;
+                    Sample s = (j <= pi) ? samples_in[pi-j]
+                                         : m_state[(order+pi-j)*nch];
+                    y += k * s;
+                }
             }
             samples_out[i] = y;
 
@@ -277,8 +1158,8 @@ void DownsampleFilter::process(const SampleVector& samples_in,
         }
 
         // We may overestimate the number of samples by 1 or 2.
-        assert(i <= n_out && i + 2 >= n_out);
-        samples_out.resize(i);
+        assert(i <= n_max && i + 2 >= n_max);
+        n_out = i;
 
         // Update fractional index of start position in text sample block.
         // Limit to 0 to avoid catastrophic results of rounding errors.
@@ -287,30 +1168,454 @@ void DownsampleFilter::process(const SampleVector& samples_in,
             m_pos_frac = 0;
     }
 
-    // Update m_state.
-    if (n < order) {
-        copy(m_state.begin() + n, m_state.end(), m_state.begin());
-        copy(samples_in.begin(), samples_in.end(), m_state.end() - n);
+    return n_out;
+}
+
+
+// Filter and decimate interleaved channels directly.
+unsigned int DownsampleFilter::process_direct_multi(const Sample * samples_in,
+                                                    unsigned int n,
+                                                    Sample * samples_out)
+{
+    unsigned int order = m_order;
+    unsigned int nch = m_channels;
+    unsigned int n_out;
+
+    if (m_downsample_int != 0) {
+
+        // Integer downsample factor, no linear interpolation.
+        unsigned int p = m_pos_int;
+        unsigned int pstep = m_downsample_int;
+
+        n_out = (n - p + pstep - 1) / pstep;
+
+        unsigned int i = 0;
+        for (; p < n; p += pstep, i++) {
+            for (unsigned int c = 0; c < nch; c++) {
+                Sample y;
+                if (p >= order) {
+                    //   y = sum(samples_in[p-j] * m_coeff[j])  for j = 1 .. order
+                    y = dot_stride(samples_in + (p - order) * nch + c, nch,
+                                   m_coeff_rev.data() + 1, order);
+                } else {
+                    y = 0;
+                    for (unsigned int j = 1; j <= order; j++)
+                        y += history(samples_in, int(p) - int(j), c) *
+                             m_coeff[j];
+                }
+                samples_out[i*nch+c] = y;
+            }
+        }
+
+        assert(i == n_out);
+
+        m_pos_int = p - n;
+
+    } else if (m_up != 0) {
+
+        // Rational downsample factor. Apply the precomputed coefficients
+        // of the phase of each output frame to every channel.
+        unsigned int taps = order + 1;
+        unsigned int pi = m_pos_int;
+        unsigned int ph = m_phase;
+
+        unsigned int i = 0;
+        while (pi < n) {
+            const Sample * kr = m_coeff_phase.data() + ph * taps;
+            for (unsigned int c = 0; c < nch; c++) {
+                Sample y;
+                if (pi >= order) {
+                    y = dot_stride(samples_in + (pi - order) * nch + c, nch,
+                                   kr, taps);
+                } else {
+                    y = 0;
+                    for (unsigned int t = 0; t <= order; t++)
+                        y += history(samples_in, int(pi + t) - int(order), c) *
+                             kr[t];
+                }
+                samples_out[i*nch+c] = y;
+            }
+            i++;
+
+            ph += m_down;
+            pi += ph / m_up;
+            ph %= m_up;
+        }
+
+        n_out = i;
+
+        m_pos_int = pi - n;
+        m_phase = ph;
+
     } else {
-        copy(samples_in.end() - order, samples_in.end(), m_state.begin());
+
+        // Fractional downsample factor. Interpolate the coefficients
+        // once per output frame, then apply them to every channel.
+        double p = m_pos_frac;
+        double pstep = m_downsample;
+        unsigned int n_max = int(2 + n / pstep);
+        Sample * kr = m_coeff_interp.data();
+
+        unsigned int i = 0;
+        double pf = p;
+        unsigned int pi = int(pf);
+        while (pi < n) {
+            Sample k1 = Sample(pf - pi);
+            Sample k0 = 1 - k1;
+
+            // Interpolated coefficients in reversed order:
+            //   kr[t] = m_coeff[order-t] * k0 + m_coeff[order-t+1] * k1
+            for (unsigned int t = 0; t <= order; t++)
+                kr[t] = m_coeff_rev[t+1] * k0 + m_coeff_rev[t] * k1;
+
+            for (unsigned int c = 0; c < nch; c++) {
+                Sample y;
+                if (pi >= order) {
+                    y = dot_stride(samples_in + (pi - order) * nch + c, nch,
+                                   kr, order + 1);
+                } else {
+                    y = 0;
+                    for (unsigned int t = 0; t <= order; t++)
+                        y += history(samples_in, int(pi + t) - int(order), c) *
+                             kr[t];
+                }
+                samples_out[i*nch+c] = y;
+            }
+
+            i++;
+            pf = p + i * pstep;
+            pi = int(pf);
+        }
+
+        assert(i <= n_max && i + 2 >= n_max);
+        n_out = i;
+
+        m_pos_frac = pf - n;
+        if (m_pos_frac < 0)
+            m_pos_frac = 0;
     }
 
+    return n_out;
 }
 
 
-/* ****************  class LowPassFilterRC  **************** */
+// Filter and decimate samples by FFT convolution.
+unsigned int DownsampleFilter::process_fft(const Sample * samples_in,
+                                           unsigned int n,
+                                           Sample * samples_out,
+                                           unsigned int nch)
+{
+    unsigned int order = m_order;
+    unsigned int n_out;
+    unsigned int fft_size = m_fft->size();
+    unsigned int nbins = (nch == 1) ? (fft_size / 2 + 1) : fft_size;
+    unsigned int step = fft_size - order;
+
+    // Compute the filter output for every input position p:
+    //   m_fft_conv[p] = sum(m_coeff[j] * x[p-j]) for j = 1 .. order+1
+    // This is what the direct-form filter computes for output positions.
+    // Frame 0 of m_fft_conv is carried over from the previous block.
+    m_fft_conv.resize((n + 1) * nch);
+
+    for (unsigned int b = 0; b < n; b += step) {
+        unsigned int m = min(step, n - b);
+
+        if (nch == 1) {
+
+            // Collect (order) samples of history followed by m new samples.
+            // The history is channel 0 of m_state.
+            Sample * buf = m_fft_buf.data();
+            if (b < order) {
+                for (unsigned int t = b; t < order; t++)
+                    buf[t-b] = m_state[t*m_channels];
+                copy(samples_in, samples_in + b + m, buf + order - b);
+            } else {
+                copy(samples_in + b - order, samples_in + b + m, buf);
+            }
+            fill(buf + order + m, buf + fft_size, Sample(0));
 
-// Construct 1st order low-pass IIR filter.
-LowPassFilterRC::LowPassFilterRC(double timeconst)
-    : m_timeconst(timeconst)
-    , m_y1(0)
+            m_fft->forward_real(buf, m_fft_spectrum.data());
+
+            SampleComplex * spec = m_fft_spectrum.data();
+            const SampleComplex * h = m_fft_filter.data();
+            for (unsigned int k = 0; k < nbins; k++) {
+                Sample re = spec[k].real() * h[k].real() - spec[k].imag() * h[k].imag();
+                Sample im = spec[k].real() * h[k].imag() + spec[k].imag() * h[k].real();
+                spec[k] = SampleComplex(re, im);
+            }
+
+            m_fft->inverse_real(spec, buf);
+
+            // The first (order) outputs are spoiled by circular wrap-around.
+            copy(buf + order, buf + order + m, m_fft_conv.begin() + b + 1);
+
+            continue;
+        }
+
+        // Transform channels in pairs. The filter is real, so the real
+        // and imaginary parts of the result belong to the two channels.
+        for (unsigned int c = 0; c < nch; c += 2) {
+            bool pair = (c + 1 < nch);
+
+            // Collect (order) frames of history followed by m new frames.
+            // Two interleaved channels already have the layout of
+            // complex samples, so they can be copied as is.
+            SampleComplex * spec = m_fft_spectrum.data();
+            if (nch == 2 && b >= order) {
+                const SampleComplex * src = reinterpret_cast<const SampleComplex *>(
+                    samples_in + (b - order) * 2);
+                copy(src, src + order + m, spec);
+            } else {
+                for (unsigned int t = 0; t < order + m; t++) {
+                    int pos = int(b + t) - int(order);
+                    spec[t] = SampleComplex(
+                        history(samples_in, pos, c),
+                        pair ? history(samples_in, pos, c + 1) : Sample(0));
+                }
+            }
+            fill(spec + order + m, spec + fft_size, SampleComplex(0));
+
+            m_fft->forward(spec, spec);
+
+            const SampleComplex * h = m_fft_filter.data();
+            for (unsigned int k = 0; k < nbins; k++) {
+                Sample re = spec[k].real() * h[k].real() - spec[k].imag() * h[k].imag();
+                Sample im = spec[k].real() * h[k].imag() + spec[k].imag() * h[k].real();
+                spec[k] = SampleComplex(re, im);
+            }
+
+            m_fft->inverse(spec, spec);
+
+            // The first (order) outputs are spoiled by circular wrap-around.
+            Sample * conv = m_fft_conv.data() + (b + 1) * nch + c;
+            if (nch == 2) {
+                copy(spec + order, spec + order + m,
+                     reinterpret_cast<SampleComplex *>(conv));
+            } else {
+                for (unsigned int t = 0; t < m; t++) {
+                    conv[t*nch] = spec[order+t].real();
+                    if (pair)
+                        conv[t*nch+1] = spec[order+t].imag();
+                }
+            }
+        }
+    }
+
+    if (m_downsample_int != 0) {
+
+        // Integer downsample factor: pick filter outputs.
+        unsigned int p = m_pos_int;
+        unsigned int pstep = m_downsample_int;
+
+        n_out = (n - p + pstep - 1) / pstep;
+
+        unsigned int i = 0;
+        for (; p < n; p += pstep, i++) {
+            for (unsigned int c = 0; c < nch; c++)
+                samples_out[i*nch+c] = m_fft_conv[p*nch+c];
+        }
+
+        assert(i == n_out);
+
+        m_pos_int = p - n;
+
+    } else if (m_up != 0) {
+
+        // Rational downsample factor: as below, but with exact positions.
+        unsigned int pi = m_pos_int;
+        unsigned int ph = m_phase;
+
+        unsigned int i = 0;
+        while (pi < n) {
+            Sample k1 = Sample(ph) / Sample(m_up);
+            Sample k0 = 1 - k1;
+            const Sample * conv = m_fft_conv.data() + pi * nch;
+            for (unsigned int c = 0; c < nch; c++)
+                samples_out[i*nch+c] = k0 * conv[c] + k1 * conv[nch+c];
+            i++;
+
+            ph += m_down;
+            pi += ph / m_up;
+            ph %= m_up;
+        }
+
+        n_out = i;
+
+        m_pos_int = pi - n;
+        m_phase = ph;
+
+    } else {
+
+        // Fractional downsample factor: interpolating between adjacent
+        // coefficients equals interpolating between adjacent outputs.
+        double p = m_pos_frac;
+        double pstep = m_downsample;
+        unsigned int n_max = int(2 + n / pstep);
+
+        unsigned int i = 0;
+        double pf = p;
+        unsigned int pi = int(pf);
+        while (pi < n) {
+            Sample k1 = Sample(pf - pi);
+            Sample k0 = 1 - k1;
+            const Sample * conv = m_fft_conv.data() + pi * nch;
+            for (unsigned int c = 0; c < nch; c++)
+                samples_out[i*nch+c] = k0 * conv[c] + k1 * conv[nch+c];
+
+            i++;
+            pf = p + i * pstep;
+            pi = int(pf);
+        }
+
+        assert(i <= n_max && i + 2 >= n_max);
+        n_out = i;
+
+        m_pos_frac = pf - n;
+        if (m_pos_frac < 0)
+            m_pos_frac = 0;
+    }
+
+    copy(m_fft_conv.begin() + n * nch, m_fft_conv.begin() + (n + 1) * nch,
+         m_fft_conv.begin());
+
+    return n_out;
+}
+
+
+/* ****************  class DownsampleFilterFixed  **************** */
+
+// Construct fixed-point low-pass filter with optional downsampling.
+DownsampleFilterFixed::DownsampleFilterFixed(unsigned int filter_order,
+                                             double cutoff,
+                                             double downsample,
+                                             bool integer_factor)
+    : m_order(filter_order)
+    , m_downsample(integer_factor ? (uint64_t(lrint(downsample)) << 32)
+                                  : uint64_t(llrint(downsample * 4294967296.0)))
+    , m_pos(0)
+    , m_integer_factor(integer_factor)
+    , m_coeff(filter_order + 2)
+    , m_buf(filter_order)
 {
+    assert(downsample >= 1);
+    assert(filter_order > 1);
+
+    // Same coefficient layout as DownsampleFilter, but in Q15.
+    vector<double> coeff;
+    make_lanczos_coeff(filter_order - 1, cutoff, coeff);
+    m_coeff[0] = 0;
+    for (unsigned int i = 0; i < filter_order; i++) {
+        m_coeff[i+1] = min(32767L, lrint(coeff[i] * 32768));
+    }
+    m_coeff[filter_order+1] = 0;
 }
 
 
 // Process samples.
-void LowPassFilterRC::process(const SampleVector& samples_in,
-                              SampleVector& samples_out)
+void DownsampleFilterFixed::process(const Sample16Vector& samples_in,
+                                    Sample16Vector& samples_out)
+{
+    unsigned int order = m_order;
+    unsigned int n = samples_in.size();
+
+    // Append input to the history, so all filter taps are contiguous.
+    // Input sample p is at s[p], history samples are at s[-order .. -1].
+    m_buf.resize(order + n);
+    copy(samples_in.begin(), samples_in.end(), m_buf.begin() + order);
+    const int16_t * s = m_buf.data() + order;
+    const int16_t * coeff = m_coeff.data();
+
+    if (m_integer_factor) {
+
+        unsigned int p = m_pos >> 32;
+        unsigned int pstep = m_downsample >> 32;
+
+        samples_out.resize((p < n) ? (n - p + pstep - 1) / pstep : 0);
+
+        // Q14 samples times Q15 coefficients gives Q29.
+        unsigned int i = 0;
+        for (; p < n; p += pstep, i++) {
+            const int16_t * w = s + p - order;
+            int32_t y = 0;
+            for (unsigned int j = 1; j <= order; j++)
+                y += w[order-j] * coeff[j];
+            samples_out[i] = fixed_round_sat(y, 15);
+        }
+
+        m_pos = uint64_t(p - n) << 32;
+
+    } else {
+
+        // Position of output samples as 32.32 fixed-point number.
+        uint64_t pos = m_pos;
+        uint64_t pstep = m_downsample;
+        uint64_t pend = uint64_t(n) << 32;
+
+        samples_out.resize((pos < pend) ? (pend - pos + pstep - 1) / pstep : 0);
+
+        // Interpolate between adjacent coefficients:
+        //   y = k0 * sum(coeff[j] * s[pi-j]) + k1 * sum(coeff[j+1] * s[pi-j])
+        unsigned int i = 0;
+        for (; pos < pend; pos += pstep, i++) {
+            unsigned int pi = pos >> 32;
+            int64_t k1 = (pos >> 16) & 0xffff;
+            int64_t k0 = 65536 - k1;
+            const int16_t * w = s + pi - order;
+            int32_t ya = 0, yb = 0;
+            for (unsigned int j = 0; j <= order; j++) {
+                int32_t x = w[order-j];
+                ya += x * coeff[j];
+                yb += x * coeff[j+1];
+            }
+            samples_out[i] = fixed_round_sat(k0 * ya + k1 * yb, 31);
+        }
+
+        assert(i == samples_out.size());
+
+        m_pos = pos - pend;
+    }
+
+    // Keep the last (order) samples as history.
+    copy(m_buf.end() - order, m_buf.end(), m_buf.begin());
+    m_buf.resize(order);
+}
+
+
+// Advance by n input samples without computing output.
+void DownsampleFilterFixed::skip(unsigned int n, const Sample16Vector& tail)
+{
+    unsigned int order = m_order;
+    unsigned int h = tail.size();
+    assert(h <= n && h >= min(n, order));
+
+    // Move the output position as process() would.
+    if (m_integer_factor) {
+        unsigned int p = m_pos >> 32;
+        unsigned int pstep = m_downsample >> 32;
+        if (p < n)
+            p += (n - p + pstep - 1) / pstep * pstep;
+        m_pos = uint64_t(p - n) << 32;
+    } else {
+        uint64_t pend = uint64_t(n) << 32;
+        if (m_pos < pend)
+            m_pos += (pend - m_pos + m_downsample - 1) / m_downsample
+                     * m_downsample;
+        m_pos -= pend;
+    }
+
+    // Shift the tail into the history.
+    for (unsigned int t = 0; t < order; t++)
+        m_buf[t] = (t + h >= order) ? tail[t+h-order] : m_buf[t+h];
+}
+
+
+/* ****************  class LowPassFilterRC  **************** */
+
+/**
+ * Design 1st order RC low-pass filter:
+ *   H(z) = b0 / (1 + a1/z)
+ */
+static void design_lowpass_rc(double timeconst, double& b0, double& a1)
 {
     /*
      * Continuous domain:
@@ -319,36 +1624,50 @@ void LowPassFilterRC::process(const SampleVector& samples_in,
      * Discrete domain:
      *   H(z) = (1 - exp(-1/timeconst)) / (1 - exp(-1/timeconst) / z)
      */
-    Sample a1 = - exp(-1/m_timeconst);;
-    Sample b0 = 1 + a1;
+    a1 = - exp(-1/timeconst);
+    b0 = 1 + a1;
+}
 
-    unsigned int n = samples_in.size();
-    samples_out.resize(n);
 
-    Sample y = m_y1;
-    for (unsigned int i = 0; i < n; i++) {
-        Sample x = samples_in[i];
-        y = b0 * x - a1 * y;
-        samples_out[i] = y;
-    }
+// Construct 1st order low-pass IIR filter.
+LowPassFilterRC::LowPassFilterRC(double timeconst)
+    : m_y1(0)
+{
+    double b0, a1;
+    design_lowpass_rc(timeconst, b0, a1);
+    m_a1 = a1;
+    m_b0 = b0;
+}
 
-    m_y1 = y;
+
+// Process samples.
+void LowPassFilterRC::process(const SampleVector& samples_in,
+                              SampleVector& samples_out)
+{
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
 }
 
 
 // Process samples in-place.
 void LowPassFilterRC::process_inplace(SampleVector& samples)
 {
-    Sample a1 = - exp(-1/m_timeconst);;
-    Sample b0 = 1 + a1;
+    process(samples.data(), samples.size(), samples.data());
+}
 
-    unsigned int n = samples.size();
+
+// Process n samples from samples_in to samples_out.
+void LowPassFilterRC::process(const Sample * samples_in, unsigned int n,
+                              Sample * samples_out)
+{
+    Sample a1 = m_a1;
+    Sample b0 = m_b0;
 
     Sample y = m_y1;
     for (unsigned int i = 0; i < n; i++) {
-        Sample x = samples[i];
+        Sample x = samples_in[i];
         y = b0 * x - a1 * y;
-        samples[i] = y;
+        samples_out[i] = y;
     }
 
     m_y1 = y;
@@ -402,10 +1721,15 @@ LowPassFilterIir::LowPassFilterIir(double cutoff)
 void LowPassFilterIir::process(const SampleVector& samples_in,
                                SampleVector& samples_out)
 {
-    unsigned int n = samples_in.size();
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
 
-    samples_out.resize(n);
 
+// Process n samples from samples_in to samples_out.
+void LowPassFilterIir::process(const Sample * samples_in, unsigned int n,
+                               Sample * samples_out)
+{
     for (unsigned int i = 0; i < n; i++) {
         Sample x = samples_in[i];
         Sample y = b0 * x - a1 * y1 - a2 * y2 - a3 * y3 - a4 * y4;
@@ -417,9 +1741,12 @@ void LowPassFilterIir::process(const SampleVector& samples_in,
 
 /* ****************  class HighPassFilterIir  **************** */
 
-// Construct 2nd order high-pass IIR filter.
-HighPassFilterIir::HighPassFilterIir(double cutoff)
-    : x1(0), x2(0), y1(0), y2(0)
+/**
+ * Design 2nd order Butterworth high-pass filter:
+ *   H(z) = (b0 + b1/z + b2/z**2) / (1 + a1/z + a2/z**2)
+ */
+static void design_highpass_iir(double cutoff, double& b0, double& b1,
+                                double& b2, double& a1, double& a2)
 {
     typedef complex<double> CDbl;
 
@@ -457,14 +1784,40 @@ HighPassFilterIir::HighPassFilterIir(double cutoff)
 }
 
 
+// Construct 2nd order high-pass IIR filter.
+HighPassFilterIir::HighPassFilterIir(double cutoff)
+    : x1(0), x2(0), y1(0), y2(0)
+{
+    double c[5];
+    design_highpass_iir(cutoff, c[0], c[1], c[2], c[3], c[4]);
+    b0 = c[0];
+    b1 = c[1];
+    b2 = c[2];
+    a1 = c[3];
+    a2 = c[4];
+}
+
+
 // Process samples.
 void HighPassFilterIir::process(const SampleVector& samples_in,
                                 SampleVector& samples_out)
 {
-    unsigned int n = samples_in.size();
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
+
+
+// Process samples in-place.
+void HighPassFilterIir::process_inplace(SampleVector& samples)
+{
+    process(samples.data(), samples.size(), samples.data());
+}
 
-    samples_out.resize(n);
 
+// Process n samples from samples_in to samples_out.
+void HighPassFilterIir::process(const Sample * samples_in, unsigned int n,
+                                Sample * samples_out)
+{
     for (unsigned int i = 0; i < n; i++) {
         Sample x = samples_in[i];
         Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
@@ -475,18 +1828,43 @@ void HighPassFilterIir::process(const SampleVector& samples_in,
 }
 
 
-// Process samples in-place.
-void HighPassFilterIir::process_inplace(SampleVector& samples)
+/* ****************  class IirFilterPair  **************** */
+
+// Construct two-channel filter.
+IirFilterPair::IirFilterPair(double cutoff, double timeconst)
+    : m_x1(), m_x2(), m_y1(), m_y2(), m_z1()
 {
-    unsigned int n = samples.size();
+    double c[5];
+    design_highpass_iir(cutoff, c[0], c[1], c[2], c[3], c[4]);
+    m_hp_b0 = c[0];
+    m_hp_b1 = c[1];
+    m_hp_b2 = c[2];
+    m_hp_a1 = c[3];
+    m_hp_a2 = c[4];
+
+    design_lowpass_rc(timeconst, c[0], c[1]);
+    m_lp_b0 = c[0];
+    m_lp_a1 = c[1];
+}
+
+
+// Process n samples of both channels.
+void IirFilterPair::process(const Sample * samples_in0,
+                            const Sample * samples_in1,
+                            unsigned int n,
+                            Sample * samples_out0, Sample * samples_out1)
+{
+    // Work on a local copy to keep the filter state in registers.
+    IirFilterPair f = *this;
 
     for (unsigned int i = 0; i < n; i++) {
-        Sample x = samples[i];
-        Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
-        x2 = x1; x1 = x;
-        y2 = y1; y1 = y;
-        samples[i] = y;
+        SamplePair x = { samples_in0[i], samples_in1[i] };
+        SamplePair y = f.process_sample(x);
+        samples_out0[i] = y[0];
+        samples_out1[i] = y[1];
     }
+
+    *this = f;
 }
 
 /* end */
@@ -38,40 +38,170 @@
 #ifndef SOFTFM_FILTER_H
 #define SOFTFM_FILTER_H
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include "SoftFM.h"
+#include "Fft.h"
+#include "StageTiming.h"
 
 
-/** Fine tuner which shifts the frequency of an IQ signal by a fixed offset. */
+/**
+ *  Adaptive DC offset and IQ imbalance correction for raw RTL-SDR data.
+ *
+ *  Raw 8-bit IQ data is converted to IQ samples and corrected in one pass.
+ *  The DC offset is subtracted, Q is scaled to the power of I, and the part
+ *  of Q which correlates with I is removed. Statistics of the corrected
+ *  samples are gathered during the conversion; after each block they move
+ *  the correction towards zero mean, equal I/Q power and zero correlation.
+ */
+class IQCorrector
+{
+public:
+
+    /** Default adaptation time constant in samples. */
+    static constexpr double default_timeconst = 1.0e6;
+
+    /**
+     * Construct IQ corrector.
+     *
+     * timeconst    :: Adaptation time constant in samples.
+     */
+    IQCorrector(double timeconst=default_timeconst);
+
+    /** Convert and correct raw IQ data. */
+    void process(const RawSampleVector& samples_in,
+                 IQSampleVector& samples_out);
+
+    /**
+     * Convert and correct n raw IQ pairs.
+     * samples_in holds 2 * n interleaved unsigned 8-bit I/Q values.
+     */
+    void process(const std::uint8_t * samples_in, unsigned int n,
+                 IQSample * samples_out);
+
+    /** Forget the current estimates and start from no correction. */
+    void reset();
+
+    /** Return the estimated DC offset relative to full scale. */
+    IQSample get_dc_offset() const
+    {
+        return IQSample(m_dc_re, m_dc_im);
+    }
+
+    /** Return the gain applied to Q. */
+    double get_gain() const
+    {
+        return m_gain;
+    }
+
+    /** Return the fraction of I added to Q. */
+    double get_phase() const
+    {
+        return m_phase;
+    }
+
+private:
+    const double    m_timeconst;
+    double          m_dc_re, m_dc_im;
+    double          m_gain;
+    double          m_phase;
+};
+
+
+/**
+ *  Fine tuner which shifts the frequency of an IQ signal by a fixed offset.
+ *
+ *  The local oscillator is a numerically controlled oscillator with a 32-bit
+ *  phase accumulator, giving a frequency resolution of sample_rate / 2**32.
+ *  Rotators are advanced by a complex recurrence over several parallel lanes
+ *  and periodically re-synchronized with the phase accumulator to prevent
+ *  drift of amplitude and phase.
+ */
 class FineTuner
 {
 public:
 
+    /** Number of parallel rotators. */
+    static constexpr unsigned int lanes = 8;
+
+    /** Number of samples between re-synchronizations of the rotators. */
+    static constexpr unsigned int resync_interval = 1024;
+
     /**
      * Construct fine tuner.
      *
-     * table_size :: Size of internal sin/cos tables, determines the resolution
-     *               of the frequency shift.
-     *
-     * freq_shift :: Frequency shift. Signal frequency will be shifted by
-     *               (sample_rate * freq_shift / table_size).
+     * freq_shift :: Frequency shift relative to the sample rate
+     *               (valid range -0.5 .. 0.5).
+     *               Signal frequency will be shifted by
+     *               (sample_rate * freq_shift).
      */
-    FineTuner(unsigned int table_size, int freq_shift);
+    FineTuner(double freq_shift);
+
+    /** Return the actual frequency shift relative to the sample rate. */
+    double get_freq_shift() const
+    {
+        return std::int32_t(m_phase_step) / 4294967296.0;
+    }
 
     /** Process samples. */
     void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
 
+    /**
+     * Process n samples from samples_in to samples_out.
+     * samples_out may be equal to samples_in for in-place processing.
+     */
+    void process(const IQSample * samples_in, unsigned int n,
+                 IQSample * samples_out);
+
+    /** Process samples in split layout. */
+    void process(const IQSplitVector& samples_in, IQSplitVector& samples_out);
+
+    /**
+     * Process n samples in split layout.
+     * The outputs may be equal to the corresponding inputs.
+     */
+    void process(const IQSample::value_type * in_re,
+                 const IQSample::value_type * in_im, unsigned int n,
+                 IQSample::value_type * out_re, IQSample::value_type * out_im);
+
+    /**
+     * Process n interleaved samples into split layout.
+     * The input and output may not overlap.
+     */
+    void process(const IQSample * samples_in, unsigned int n,
+                 IQSample::value_type * out_re, IQSample::value_type * out_im);
+
 private:
-    unsigned int    m_index;
-    IQSampleVector  m_table;
+    typedef IQSample::value_type T;
+
+    /**
+     * Process n samples with the I/Q components (Sin) and (Sout) values
+     * apart in the input and output arrays.
+     */
+    template <unsigned int Sin, unsigned int Sout>
+    void process_strided(const T * in_re, const T * in_im, unsigned int n,
+                         T * out_re, T * out_im);
+
+    std::uint32_t       m_phase;
+    std::uint32_t       m_phase_step;
+    IQSample::value_type m_step_re, m_step_im;
 };
 
 
-/** Low-pass filter for IQ samples, based on Lanczos FIR filter. */
+/**
+ *  Low-pass filter for IQ samples, based on Lanczos FIR filter.
+ *
+ *  The filter works on samples in split layout. Interleaved samples are
+ *  split on input and merged on output, in chunks of chunk_length samples.
+ */
 class LowPassFilterFirIQ
 {
 public:
 
+    /** Number of samples processed per chunk. */
+    static constexpr unsigned int chunk_length = 4096;
+
     /**
      * Construct low-pass filter.
      *
@@ -84,9 +214,318 @@ public:
     /** Process samples. */
     void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
 
+    /**
+     * Process n samples from samples_in to samples_out.
+     * samples_out may be equal to samples_in for in-place processing.
+     */
+    void process(const IQSample * samples_in, unsigned int n,
+                 IQSample * samples_out);
+
+    /** Process samples in split layout. */
+    void process(const IQSplitVector& samples_in, IQSplitVector& samples_out);
+
+    /**
+     * Process n samples in split layout.
+     * The outputs may be equal to the corresponding inputs.
+     */
+    void process(const IQSample::value_type * in_re,
+                 const IQSample::value_type * in_im, unsigned int n,
+                 IQSample::value_type * out_re, IQSample::value_type * out_im);
+
+private:
+    typedef IQSample::value_type T;
+
+    /**
+     * Process n samples with the I/Q components (Stride) values apart
+     * in the input and output arrays.
+     */
+    template <unsigned int Stride>
+    void process_strided(const T * in_re, const T * in_im, unsigned int n,
+                         T * out_re, T * out_im);
+
+    const unsigned int  m_order;
+    std::vector<T>      m_coeff;
+    std::vector<T>      m_buf_re;
+    std::vector<T>      m_buf_im;
+};
+
+
+/**
+ *  Half-band low-pass filter and decimation by 2 for IQ samples.
+ *
+ *  The filter is a Kaiser-windowed sinc with cutoff at a quarter of the
+ *  input sample rate, so every other coefficient is zero. It passes
+ *  signals up to 0.16 times the input sample rate with less than 1e-4
+ *  ripple and rejects what would alias into that band by at least 80 dB.
+ *
+ *  Input samples are appended to a short history, and all complete pairs
+ *  of samples are filtered in one call of the fir_decim2 kernel.
+ */
+class HalfBandDecimator
+{
+public:
+
+    /** Number of non-zero coefficients on each side of the center. */
+    static constexpr unsigned int side_taps = 8;
+
+    /** Highest frequency relative to the input sample rate that is kept. */
+    static constexpr double passband = 0.16;
+
+    /**
+     * Construct half-band decimator.
+     *
+     * max_input    :: Maximum number of input samples per call.
+     */
+    explicit HalfBandDecimator(unsigned int max_input);
+
+    /** Return the number of output samples for the next n input samples. */
+    unsigned int get_output_size(unsigned int n) const;
+
+    /** Return the group delay in input samples. */
+    unsigned int get_delay() const
+    {
+        return 2 * side_taps - 1;
+    }
+
+    /**
+     * Process n samples in split layout and return the number of
+     * output samples; n may not exceed max_input.
+     * The outputs may be equal to the corresponding inputs.
+     */
+    unsigned int process(const IQSample::value_type * in_re,
+                         const IQSample::value_type * in_im, unsigned int n,
+                         IQSample::value_type * out_re,
+                         IQSample::value_type * out_im);
+
 private:
-    std::vector<IQSample::value_type> m_coeff;
-    IQSampleVector  m_state;
+    typedef IQSample::value_type T;
+
+    const unsigned int  m_max_input;
+    unsigned int        m_len;
+    std::vector<T>      m_coeff;
+    std::vector<T>      m_buf_re;
+    std::vector<T>      m_buf_im;
+};
+
+
+/**
+ *  Frequency shift, low-pass filter and decimation for IQ samples.
+ *
+ *  This combines a FineTuner, a cascade of half-band decimators and a
+ *  Lanczos low-pass FIR filter with integer downsampler. The input is
+ *  processed in short chunks, so the frequency-shifted samples are still
+ *  in cache when they are filtered, and filter outputs are only computed
+ *  for samples that are kept.
+ *
+ *  Factors of 2 of the decimation are taken by half-band stages while
+ *  the passband fits them and a factor of at least 2 remains. The final
+ *  FIR then runs at the reduced sample rate with proportionally fewer
+ *  taps and decimates by the rest, e.g. by 3 for a factor of 12.
+ *  A final decimation by 2 is computed for a whole chunk at a time when
+ *  the output is in split layout.
+ *
+ *  The frequency shift splits the interleaved input into separate I and Q
+ *  arrays, which the filter reads without shuffles. The output is written
+ *  either interleaved or in split layout.
+ */
+class DownconverterIQ
+{
+public:
+
+    /** Number of input samples processed per chunk. */
+    static constexpr unsigned int chunk_length = 4096;
+
+    /**
+     * Construct downconverter.
+     *
+     * freq_shift   :: Frequency shift relative to the input sample rate
+     *                 (valid range -0.5 .. 0.5).
+     * filter_order :: FIR filter order at the input sample rate;
+     *                 the final FIR uses (filter_order >> n) after
+     *                 n half-band stages.
+     * cutoff       :: Cutoff frequency relative to the input sample rate
+     *                 (valid range 0.0 .. 0.5).
+     * downsample   :: Integer decimation factor (>= 1).
+     *
+     * The output sample rate is (input_sample_rate / downsample)
+     */
+    DownconverterIQ(double freq_shift, unsigned int filter_order,
+                    double cutoff, unsigned int downsample);
+
+    /** Return the actual frequency shift relative to the input sample rate. */
+    double get_freq_shift() const
+    {
+        return m_finetuner.get_freq_shift();
+    }
+
+    /** Return the number of half-band stages before the final FIR. */
+    unsigned int get_halfband_stages() const
+    {
+        return m_halfband.size();
+    }
+
+    /** Return the group delay of the filters in input samples. */
+    double get_delay() const;
+
+    /**
+     * Return the number of half-band stages that a downconverter
+     * constructed with these arguments uses.
+     */
+    static unsigned int count_halfband_stages(double cutoff,
+                                              unsigned int downsample);
+
+    /** Return the number of output samples for the next n input samples. */
+    unsigned int get_output_size(unsigned int n) const;
+
+    /** Return the maximum number of output samples for any n input samples. */
+    unsigned int get_max_output_size(unsigned int n) const
+    {
+        return (n + m_downsample - 1) / m_downsample;
+    }
+
+    /** Return the stage timing counters (empty unless SOFTFM_STAGE_TIMING). */
+    StageCounters& get_stage_counters()
+    {
+        return m_stage_counters;
+    }
+
+    const StageCounters& get_stage_counters() const
+    {
+        return m_stage_counters;
+    }
+
+    /** Process samples. */
+    void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+    /**
+     * Process n samples and return the number of output samples.
+     *
+     * samples_out must have room for get_output_size(n) samples.
+     * It may be equal to samples_in for in-place processing.
+     */
+    unsigned int process(const IQSample * samples_in, unsigned int n,
+                         IQSample * samples_out);
+
+    /** Process samples into split layout. */
+    void process(const IQSampleVector& samples_in, IQSplitVector& samples_out);
+
+    /**
+     * Process n samples into split layout and return the number of
+     * output samples.
+     *
+     * out_re and out_im must have room for get_output_size(n) samples.
+     * The outputs may not overlap the input.
+     */
+    unsigned int process(const IQSample * samples_in, unsigned int n,
+                         IQSample::value_type * out_re,
+                         IQSample::value_type * out_im);
+
+private:
+    typedef IQSample::value_type T;
+
+    /**
+     * Process n samples with the I/Q components of the output
+     * (Stride) values apart.
+     */
+    template <unsigned int Stride>
+    unsigned int process_strided(const IQSample * samples_in, unsigned int n,
+                                 T * out_re, T * out_im);
+
+    const unsigned int  m_downsample;
+    std::vector<HalfBandDecimator> m_halfband;
+    unsigned int        m_order;
+    unsigned int        m_final_downsample;
+    unsigned int        m_pos;
+    FineTuner           m_finetuner;
+    std::vector<T>      m_coeff;
+    std::vector<T>      m_buf_re;
+    std::vector<T>      m_buf_im;
+    StageCounters       m_stage_counters;
+};
+
+
+/** Number of address bits of the fixed-point sine table. */
+static constexpr unsigned int fixed_sine_bits = 12;
+
+/**
+ * Return a table of (1 << fixed_sine_bits) Q14 sine values
+ * covering one full period.
+ */
+const std::int16_t * fixed_sine_table();
+
+/** Drop (shift) fraction bits with rounding and saturate to 16 bits. */
+inline std::int16_t fixed_round_sat(std::int32_t v, unsigned int shift)
+{
+    v = (v + (std::int32_t(1) << (shift - 1))) >> shift;
+    return std::int16_t((v < -32768) ? -32768 : (v > 32767) ? 32767 : v);
+}
+
+/** Drop (shift) fraction bits with rounding and saturate to 16 bits. */
+inline std::int16_t fixed_round_sat(std::int64_t v, unsigned int shift)
+{
+    v = (v + (std::int64_t(1) << (shift - 1))) >> shift;
+    return std::int16_t((v < -32768) ? -32768 : (v > 32767) ? 32767 : v);
+}
+
+
+/**
+ *  Fixed-point variant of DownconverterIQ.
+ *
+ *  Input is raw 8-bit IQ data as produced by RTL-SDR, output is Q14 IQ
+ *  samples. The oscillator uses a 32-bit phase accumulator and a sine
+ *  table, filter coefficients are Q14 and accumulate in 32 bits.
+ */
+class DownconverterFixed
+{
+public:
+
+    /** Number of input samples processed per chunk. */
+    static constexpr unsigned int chunk_length = 4096;
+
+    /**
+     * Construct fixed-point downconverter.
+     *
+     * Arguments are the same as for DownconverterIQ.
+     */
+    DownconverterFixed(double freq_shift, unsigned int filter_order,
+                       double cutoff, unsigned int downsample);
+
+    /** Return the actual frequency shift relative to the input sample rate. */
+    double get_freq_shift() const
+    {
+        return std::int32_t(m_phase_step) / 4294967296.0;
+    }
+
+    /** Return the group delay of the filter in input samples. */
+    double get_delay() const
+    {
+        return 0.5 * m_order;
+    }
+
+    /** Return the stage timing counters (empty unless SOFTFM_STAGE_TIMING). */
+    StageCounters& get_stage_counters()
+    {
+        return m_stage_counters;
+    }
+
+    const StageCounters& get_stage_counters() const
+    {
+        return m_stage_counters;
+    }
+
+    /** Process samples. */
+    void process(const RawSampleVector& samples_in,
+                 IQSample16Vector& samples_out);
+
+private:
+    const unsigned int  m_order;
+    const unsigned int  m_downsample;
+    unsigned int        m_pos;
+    std::uint32_t       m_phase;
+    std::uint32_t       m_phase_step;
+    std::vector<std::int16_t> m_coeff;
+    std::vector<std::int16_t> m_buf;
+    StageCounters       m_stage_counters;
 };
 
 
@@ -95,11 +534,28 @@ private:
  *
  *  Step 1: Low-pass filter based on Lanczos FIR filter
  *  Step 2: (optional) Decimation by an arbitrary factor (integer or float)
+ *
+ *  Long filters are evaluated by overlap-save FFT convolution at the input
+ *  sample rate, followed by decimation of the filtered signal. Short filters
+ *  are evaluated directly at the output sample rate.
+ *
+ *  Several channels can be processed together as interleaved frames.
+ *  The sample positions and interpolated coefficients are computed once
+ *  for all channels, so the channels stay in sync by construction.
  */
 class DownsampleFilter
 {
 public:
 
+    /**
+     * Number of multiplications per input sample above which the
+     * direct-form filter is replaced by FFT convolution.
+     */
+    static constexpr unsigned int fft_crossover = 32;
+
+    /** Maximum number of phases of a rational downsample factor. */
+    static constexpr unsigned int max_phases = 64;
+
     /**
      * Construct low-pass filter with optional downsampling.
      *
@@ -109,22 +565,200 @@ public:
      * downsample   :: Decimation factor (>= 1) or 1 to disable
      * integer_factor :: Enables a faster and more precise algorithm that
      *                   only works for integer downsample factors.
+     * channels     :: Number of interleaved channels (>= 1)
      *
      * The output sample rate is (input_sample_rate / downsample)
+     *
+     * Without integer_factor, a rational downsample factor (see
+     * find_rational()) uses a polyphase filter with precomputed
+     * coefficients for each phase. Other factors interpolate the
+     * coefficients for every output sample.
      */
     DownsampleFilter(unsigned int filter_order, double cutoff,
-                     double downsample=1, bool integer_factor=true);
+                     double downsample=1, bool integer_factor=true,
+                     unsigned int channels=1);
+
+    /**
+     * Find integers up and down with (down / up == downsample) and
+     * (up <= max_phases). Return false if there are none.
+     */
+    static bool find_rational(double downsample,
+                              unsigned int& up, unsigned int& down);
+
+    /**
+     * Return true if a filter constructed with these arguments
+     * uses FFT convolution instead of the direct-form filter.
+     */
+    static bool prefers_fft(unsigned int filter_order, double downsample,
+                            bool integer_factor, unsigned int channels);
+
+    /** Return true if the filter uses FFT convolution. */
+    bool uses_fft() const
+    {
+        return bool(m_fft);
+    }
+
+    /** Return the maximum number of output frames for n input frames. */
+    unsigned int get_max_output_size(unsigned int n) const;
 
     /** Process samples. */
     void process(const SampleVector& samples_in, SampleVector& samples_out);
 
+    /**
+     * Process n frames and return the number of output frames.
+     *
+     * A frame holds one sample of each channel.
+     * samples_out must have room for get_max_output_size(n) frames.
+     * The input and output may not overlap.
+     */
+    unsigned int process(const Sample * samples_in, unsigned int n,
+                         Sample * samples_out);
+
+    /**
+     * Process n samples of the first channel only and return the number
+     * of output samples.
+     *
+     * samples_in holds one sample per frame, samples_out receives one
+     * sample per output frame. The history of the other channels goes
+     * stale; restore it with set_history() before the next call to
+     * process().
+     */
+    unsigned int process_first(const Sample * samples_in, unsigned int n,
+                               Sample * samples_out);
+
+    /**
+     * Replace the input history of one channel.
+     *
+     * samples holds the n most recent input samples of the channel.
+     * Only the last get_history_length() samples are used.
+     */
+    void set_history(unsigned int channel, const Sample * samples,
+                     unsigned int n);
+
+    /** Return the number of input samples kept as history per channel. */
+    unsigned int get_history_length() const
+    {
+        return m_order;
+    }
+
+    /**
+     * Return the number of new input frames per FFT block, or 0 for the
+     * direct-form filter. Every call transforms at least one whole block,
+     * so calls with fewer frames waste part of the work.
+     */
+    unsigned int get_fft_step() const
+    {
+        return m_fft ? m_fft->size() - m_order : 0;
+    }
+
+    /** Return the group delay in input samples. */
+    double get_delay() const
+    {
+        return 0.5 * (m_order + 1);
+    }
+
 private:
+    typedef std::complex<Sample> SampleComplex;
+
+    /** Filter and decimate the first channel directly. */
+    unsigned int process_direct(const Sample * samples_in, unsigned int n,
+                                Sample * samples_out);
+
+    /** Filter and decimate interleaved channels directly. */
+    unsigned int process_direct_multi(const Sample * samples_in,
+                                      unsigned int n, Sample * samples_out);
+
+    /** Filter and decimate nch interleaved channels by FFT convolution. */
+    unsigned int process_fft(const Sample * samples_in, unsigned int n,
+                             Sample * samples_out, unsigned int nch);
+
+    /** Return sample (pos, channel) where negative pos refers to m_state. */
+    Sample history(const Sample * samples_in, int pos,
+                   unsigned int channel) const
+    {
+        unsigned int nch = m_channels;
+        return (pos >= 0) ? samples_in[pos * nch + channel]
+                          : m_state[(m_order + pos) * nch + channel];
+    }
+
+    const unsigned int m_order;
+    const unsigned int m_channels;
     double          m_downsample;
     unsigned int    m_downsample_int;
+    unsigned int    m_up;
+    unsigned int    m_down;
     unsigned int    m_pos_int;
-    Sample          m_pos_frac;
+    unsigned int    m_phase;
+    double          m_pos_frac;
     SampleVector    m_coeff;
+    SampleVector    m_coeff_rev;
+    SampleVector    m_coeff_interp;
+    SampleVector    m_coeff_phase;
     SampleVector    m_state;
+
+    // FFT convolution, only used if m_fft is set.
+    // A single channel uses a real transform. Multiple channels are
+    // transformed in pairs, as the real and imaginary parts of
+    // a complex transform.
+    std::shared_ptr<const FftPlan<Sample>> m_fft;
+    std::vector<SampleComplex> m_fft_filter;
+    std::vector<SampleComplex> m_fft_spectrum;
+    SampleVector    m_fft_buf;
+    SampleVector    m_fft_conv;
+};
+
+
+/**
+ *  Fixed-point variant of DownsampleFilter.
+ *
+ *  Input and output are Q14 samples. Filter coefficients are Q15 and
+ *  the fractional position is tracked as a 32.32 fixed-point number.
+ */
+class DownsampleFilterFixed
+{
+public:
+
+    /**
+     * Construct low-pass filter with optional downsampling.
+     *
+     * Arguments are the same as for DownsampleFilter.
+     */
+    DownsampleFilterFixed(unsigned int filter_order, double cutoff,
+                          double downsample=1, bool integer_factor=true);
+
+    /** Return the group delay in input samples. */
+    double get_delay() const
+    {
+        return 0.5 * (m_order + 1);
+    }
+
+    /** Return the number of input samples kept as history. */
+    unsigned int get_history_length() const
+    {
+        return m_order;
+    }
+
+    /** Process samples. */
+    void process(const Sample16Vector& samples_in,
+                 Sample16Vector& samples_out);
+
+    /**
+     * Advance by n input samples without computing output.
+     *
+     * tail holds the most recent of the skipped samples, at least
+     * min(n, get_history_length()) of them. It becomes the input history,
+     * so the next call to process() continues as if all n samples had
+     * been processed.
+     */
+    void skip(unsigned int n, const Sample16Vector& tail);
+
+private:
+    const unsigned int  m_order;
+    std::uint64_t       m_downsample;
+    std::uint64_t       m_pos;
+    bool                m_integer_factor;
+    std::vector<std::int16_t> m_coeff;
+    Sample16Vector      m_buf;
 };
 
 
@@ -146,8 +780,22 @@ public:
     /** Process samples in-place. */
     void process_inplace(SampleVector& samples);
 
+    /**
+     * Process n samples from samples_in to samples_out.
+     * samples_out may be equal to samples_in for in-place processing.
+     */
+    void process(const Sample * samples_in, unsigned int n,
+                 Sample * samples_out);
+
+    /** Process a single sample and return the filter output. */
+    Sample process_sample(Sample x)
+    {
+        m_y1 = m_b0 * x - m_a1 * m_y1;
+        return m_y1;
+    }
+
 private:
-    double  m_timeconst;
+    Sample  m_a1, m_b0;
     Sample  m_y1;
 };
 
@@ -168,6 +816,13 @@ public:
     /** Process samples. */
     void process(const SampleVector& samples_in, SampleVector& samples_out);
 
+    /**
+     * Process n samples from samples_in to samples_out.
+     * samples_out may be equal to samples_in for in-place processing.
+     */
+    void process(const Sample * samples_in, unsigned int n,
+                 Sample * samples_out);
+
 private:
     Sample  b0, a1, a2, a3, a4;
     Sample  y1, y2, y3, y4;
@@ -193,9 +848,75 @@ public:
     /** Process samples in-place. */
     void process_inplace(SampleVector& samples);
 
+    /**
+     * Process n samples from samples_in to samples_out.
+     * samples_out may be equal to samples_in for in-place processing.
+     */
+    void process(const Sample * samples_in, unsigned int n,
+                 Sample * samples_out);
+
+    /** Process a single sample and return the filter output. */
+    Sample process_sample(Sample x)
+    {
+        Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1; x1 = x;
+        y2 = y1; y1 = y;
+        return y;
+    }
+
 private:
     Sample b0, b1, b2, a1, a2;
     Sample x1, x2, y1, y2;
 };
 
+
+/**
+ *  DC blocking and de-emphasis filter for two channels.
+ *
+ *  Applies a HighPassFilterIir followed by a LowPassFilterRC to two
+ *  channels in lockstep. A recursive filter can not be vectorized along
+ *  time, but the two channels share the lanes of one SIMD register.
+ */
+class IirFilterPair
+{
+public:
+
+    /** One sample of each of the two channels. */
+    typedef Sample SamplePair __attribute__((vector_size(2 * sizeof(Sample))));
+
+    /**
+     * Construct two-channel filter.
+     *
+     * cutoff       :: High-pass cutoff relative to the sample frequency
+     *                 (see HighPassFilterIir)
+     * timeconst    :: Low-pass RC time constant in samples
+     *                 (see LowPassFilterRC)
+     */
+    IirFilterPair(double cutoff, double timeconst);
+
+    /**
+     * Process n samples of both channels.
+     * Outputs may be equal to the corresponding inputs.
+     */
+    void process(const Sample * samples_in0, const Sample * samples_in1,
+                 unsigned int n,
+                 Sample * samples_out0, Sample * samples_out1);
+
+    /** Process one sample of both channels and return the outputs. */
+    SamplePair process_sample(SamplePair x)
+    {
+        SamplePair y = m_hp_b0 * x + m_hp_b1 * m_x1 + m_hp_b2 * m_x2
+                       - m_hp_a1 * m_y1 - m_hp_a2 * m_y2;
+        m_x2 = m_x1; m_x1 = x;
+        m_y2 = m_y1; m_y1 = y;
+        m_z1 = m_lp_b0 * y - m_lp_a1 * m_z1;
+        return m_z1;
+    }
+
+private:
+    Sample      m_hp_b0, m_hp_b1, m_hp_b2, m_hp_a1, m_hp_a2;
+    Sample      m_lp_b0, m_lp_a1;
+    SamplePair  m_x1, m_x2, m_y1, m_y2, m_z1;
+};
+
 #endif
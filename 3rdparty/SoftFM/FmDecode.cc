@@ -38,6 +38,7 @@
 #include <cassert>
 #include <cmath>
 
+#include "DspKernels.h"
 #include "FmDecode.h"
 
 using namespace std;
@@ -69,20 +70,151 @@ static inline Sample fast_atan(Sample x)
 }
 
 
-/** Compute RMS level over a small prefix of the specified sample vector. */
-static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
+/**
+ * Compute the phase angle of (x, y) with CORDIC in vectoring mode.
+ * Return the angle as a 16-bit binary angle (65536 represents 2*Pi).
+ */
+static inline uint16_t cordic_angle(int32_t x, int32_t y)
+{
+    // Binary angles of atan(2**-i).
+    static const uint16_t atan_table[14] = {
+        8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1 };
+
+    // Rotate into the right half-plane.
+    uint16_t angle = 0;
+    if (x < 0) {
+        x = -x;
+        y = -y;
+        angle = 32768;
+    }
+
+    // Scale up to preserve precision in the shifts below.
+    // Q14 input plus CORDIC gain (1.65) still fits easily in 32 bits.
+    x <<= 8;
+    y <<= 8;
+
+    // Rotate towards the positive x-axis.
+    for (int i = 0; i < 14; i++) {
+        int32_t xs = x >> i, ys = y >> i;
+        if (y > 0) {
+            x += ys;
+            y -= xs;
+            angle += atan_table[i];
+        } else {
+            x -= ys;
+            y += xs;
+            angle -= atan_table[i];
+        }
+    }
+
+    return angle;
+}
+
+
+/** Compute RMS level over a small prefix of n samples in split layout. */
+static IQSample::value_type rms_level_approx(const IQSample::value_type * re,
+                                             const IQSample::value_type * im,
+                                             unsigned int n)
 {
-    unsigned int n = samples.size();
     n = (n + 63) / 64;
 
     IQSample::value_type level = 0;
+    for (unsigned int i = 0; i < n; i++)
+        level += re[i] * re[i] + im[i] * im[i];
+
+    return sqrt(level / n);
+}
+
+
+/** Compute RMS level over a small prefix of the specified Q14 IQ vector. */
+static double rms_level_approx(const IQSample16Vector& samples)
+{
+    unsigned int n = samples.size();
+    n = (n + 63) / 64;
+
+    int64_t level = 0;
     for (unsigned int i = 0; i < n; i++) {
-        const IQSample& s = samples[i];
-        IQSample::value_type re = s.real(), im = s.imag();
+        int32_t re = samples[i].re, im = samples[i].im;
         level += re * re + im * im;
     }
 
-    return sqrt(level / n);
+    return ldexp(sqrt(double(level) / n), -fixed_frac_bits);
+}
+
+
+/** Compute mean and RMS over a Q14 sample vector. */
+static void samples_mean_rms(const Sample16Vector& samples,
+                             double& mean, double& rms)
+{
+    int64_t vsum = 0;
+    int64_t vsumsq = 0;
+
+    unsigned int n = samples.size();
+    for (unsigned int i = 0; i < n; i++) {
+        int32_t v = samples[i];
+        vsum   += v;
+        vsumsq += v * v;
+    }
+
+    mean = ldexp(double(vsum) / n, -fixed_frac_bits);
+    rms  = ldexp(sqrt(double(vsumsq) / n), -fixed_frac_bits);
+}
+
+
+/**
+ * Convert Q14 samples to floating point.
+ * Write every stride-th element of samples_out, starting at index 0.
+ */
+static void samples_from_fixed(const Sample16Vector& samples_in,
+                               Sample * samples_out, unsigned int stride)
+{
+    const Sample scale = Sample(1) / (1 << fixed_frac_bits);
+    unsigned int n = samples_in.size();
+
+    for (unsigned int i = 0; i < n; i++) {
+        samples_out[i * stride] = samples_in[i] * scale;
+    }
+}
+
+
+/** Store audio samples without conversion. */
+struct StoreSample
+{
+    Sample * p;
+
+    void operator()(unsigned int i, Sample v) const
+    {
+        p[i] = v;
+    }
+};
+
+
+/** Store audio samples as float, clipped to full scale. */
+struct StoreFloat
+{
+    float * p;
+
+    void operator()(unsigned int i, Sample v) const
+    {
+        p[i] = max(Sample(-1.0), min(Sample(1.0), v));
+    }
+};
+
+
+/** Return true if the audio downsample factor is an integer. */
+static bool is_integer_factor(double downsample)
+{
+    unsigned int up, down;
+    return DownsampleFilter::find_rational(downsample, up, down) && up == 1;
+}
+
+
+/** Grow a buffer to at least n elements; never shrink it. */
+template <class T>
+static void grow_buffer(vector<T>& buf, unsigned int n)
+{
+    if (buf.size() < n)
+        buf.resize(n);
 }
 
 
@@ -97,22 +229,75 @@ PhaseDiscriminator::PhaseDiscriminator(double max_freq_dev)
 // Process samples.
 void PhaseDiscriminator::process(const IQSampleVector& samples_in,
                                  SampleVector& samples_out)
+{
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
+
+
+// Process n samples from samples_in to samples_out.
+void PhaseDiscriminator::process(const IQSample * samples_in, unsigned int n,
+                                 Sample * samples_out)
+{
+    dsp_kernels().phase_diff(samples_in, n, m_last_sample,
+                             m_freq_scale_factor, samples_out);
+
+    if (n > 0)
+        m_last_sample = samples_in[n-1];
+}
+
+
+// Process samples in split layout.
+void PhaseDiscriminator::process(const IQSplitVector& samples_in,
+                                 SampleVector& samples_out)
+{
+    samples_out.resize(samples_in.size());
+    process(samples_in.re.data(), samples_in.im.data(), samples_in.size(),
+            samples_out.data());
+}
+
+
+// Process n samples in split layout to samples_out.
+void PhaseDiscriminator::process(const IQSample::value_type * in_re,
+                                 const IQSample::value_type * in_im,
+                                 unsigned int n, Sample * samples_out)
+{
+    dsp_kernels().phase_diff_split(in_re, in_im, n, m_last_sample,
+                                   m_freq_scale_factor, samples_out);
+
+    if (n > 0)
+        m_last_sample = IQSample(in_re[n-1], in_im[n-1]);
+}
+
+
+/* ****************  class PhaseDiscriminatorFixed  **************** */
+
+// Construct fixed-point phase discriminator.
+PhaseDiscriminatorFixed::PhaseDiscriminatorFixed(double max_freq_dev)
+    : m_freq_scale_factor(lrint((1 << fixed_frac_bits) / max_freq_dev))
+    , m_last_phase(0)
+{ }
+
+
+// Process samples.
+void PhaseDiscriminatorFixed::process(const IQSample16Vector& samples_in,
+                                      Sample16Vector& samples_out)
 {
     unsigned int n = samples_in.size();
-    IQSample s0 = m_last_sample;
+    uint16_t phase0 = m_last_phase;
 
     samples_out.resize(n);
 
     for (unsigned int i = 0; i < n; i++) {
-        IQSample s1(samples_in[i]);
-        IQSample d(conj(s0) * s1);
-// TODO : implement fast approximation of atan2
-        Sample w = atan2(d.imag(), d.real());
-        samples_out[i] = w * m_freq_scale_factor;
-        s0 = s1;
+        uint16_t phase1 = cordic_angle(samples_in[i].re, samples_in[i].im);
+
+        // Phase difference wraps around naturally in 16 bits.
+        int32_t d = int16_t(uint16_t(phase1 - phase0));
+        samples_out[i] = fixed_round_sat(int64_t(d) * m_freq_scale_factor, 16);
+        phase0 = phase1;
     }
 
-    m_last_sample = s0;
+    m_last_phase = phase0;
 }
 
 
@@ -143,6 +328,7 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
     m_lock_delay = int(20.0 / bandwidth);
     m_lock_cnt   = 0;
     m_pilot_level = 0;
+    m_was_locked = false;
 
     // Create 2nd order filter for I/Q representation of phase error.
     // Filter has two poles, unit DC gain.
@@ -162,8 +348,14 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
     // These integrators form the two remaining poles, both at z = 1.
 
     // Initialize frequency and phase.
-    m_freq  = freq * 2.0 * M_PI;
-    m_phase = 0;
+    m_freq0 = freq * 2.0 * M_PI;
+    m_freq  = m_freq0;
+    m_osc_re = 1;
+    m_osc_im = 0;
+
+    // Rotation per sample at the center frequency.
+    m_rot0_re = cos(m_freq0);
+    m_rot0_im = sin(m_freq0);
 
     m_phasor_i1 = 0;
     m_phasor_i2 = 0;
@@ -182,28 +374,51 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 void PilotPhaseLock::process(const SampleVector& samples_in,
                              SampleVector& samples_out)
 {
-    unsigned int n = samples_in.size();
+    samples_out.resize(samples_in.size());
+    process(samples_in.data(), samples_in.size(), samples_out.data());
+}
 
-    samples_out.resize(n);
 
-    bool was_locked = (m_lock_cnt >= m_lock_delay);
-    m_pps_events.clear();
+// Process n samples from samples_in to samples_out.
+void PilotPhaseLock::process(const Sample * samples_in, unsigned int n,
+                             Sample * samples_out)
+{
+    process_part(samples_in, n, samples_out, 0, n);
+}
 
-    if (n > 0)
-        m_pilot_level = 1000.0;
+
+// Process n samples at position offset within a block.
+void PilotPhaseLock::process_part(const Sample * samples_in, unsigned int n,
+                                  Sample * samples_out,
+                                  unsigned int offset,
+                                  unsigned int block_length)
+{
+    assert(offset + n <= block_length);
+
+    // Start a new block.
+    if (offset == 0) {
+        m_was_locked = (m_lock_cnt >= m_lock_delay);
+        m_pps_events.clear();
+        if (block_length > 0)
+            m_pilot_level = 1000.0;
+    }
+
+    bool was_locked = m_was_locked;
 
     for (unsigned int i = 0; i < n; i++) {
 
+        // Read input first, to allow in-place processing.
+        Sample x = samples_in[i];
+
         // Generate locked pilot tone.
-        Sample psin = sin(m_phase);
-        Sample pcos = cos(m_phase);
+        Sample psin = m_osc_im;
+        Sample pcos = m_osc_re;
 
         // Generate double-frequency output.
         // sin(2*x) = 2 * sin(x) * cos(x)
         samples_out[i] = 2 * psin * pcos;
 
         // Multiply locked tone with input.
-        Sample x = samples_in[i];
         Sample phasor_i = psin * x;
         Sample phasor_q = pcos * x;
 
@@ -244,10 +459,23 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
         // Limit frequency to allowable range.
         m_freq = max(m_minfreq, min(m_maxfreq, m_freq));
 
-        // Update locked phase.
-        m_phase += m_freq;
-        if (m_phase > 2.0 * M_PI) {
-            m_phase -= 2.0 * M_PI;
+        // Update locked phase by rotating the oscillator over m_freq.
+        // The deviation from the center frequency is at most the loop
+        // bandwidth, so its rotation is well approximated by
+        //   exp(j*df) = (1 - df*df/2) + j*df
+        double df = m_freq - m_freq0;
+        double dr = 1 - 0.5 * df * df;
+        double rot_re = m_rot0_re * dr - m_rot0_im * df;
+        double rot_im = m_rot0_re * df + m_rot0_im * dr;
+        double osc_re = m_osc_re * rot_re - m_osc_im * rot_im;
+        double osc_im = m_osc_re * rot_im + m_osc_im * rot_re;
+
+        // The phase wraps when the oscillator crosses the positive x-axis.
+        bool wrapped = (m_osc_im < 0 && osc_im >= 0 && osc_re > 0);
+        m_osc_re = osc_re;
+        m_osc_im = osc_im;
+
+        if (wrapped) {
             m_pilot_periods++;
 
             // Generate pulse-per-second.
@@ -256,6 +484,180 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
                 if (was_locked) {
                     struct PpsEvent ev;
                     ev.pps_index      = m_pps_cnt;
+                    ev.sample_index   = m_sample_cnt + offset + i;
+                    ev.block_position = double(offset + i) /
+                                        double(block_length);
+                    m_pps_events.push_back(ev);
+                    m_pps_cnt++;
+                }
+            }
+        }
+    }
+
+    // Renormalize the oscillator to unit amplitude.
+    double osc_scale = 1 / sqrt(m_osc_re * m_osc_re + m_osc_im * m_osc_im);
+    m_osc_re *= osc_scale;
+    m_osc_im *= osc_scale;
+
+    // The rest is done once per block.
+    if (offset + n < block_length)
+        return;
+
+    // Update lock status.
+    if (2 * m_pilot_level > m_minsignal) {
+        if (m_lock_cnt < m_lock_delay)
+            m_lock_cnt += block_length;
+    } else {
+        m_lock_cnt = 0;
+    }
+
+    // Drop PPS events when pilot not locked.
+    if (m_lock_cnt < m_lock_delay) {
+        m_pilot_periods = 0;
+        m_pps_cnt = 0;
+        m_pps_events.clear();
+    }
+
+    // Update sample counter.
+    m_sample_cnt += block_length;
+}
+
+
+/* ****************  class PilotPhaseLockFixed  **************** */
+
+// Construct fixed-point phase-locked loop.
+PilotPhaseLockFixed::PilotPhaseLockFixed(double freq, double bandwidth,
+                                         double minsignal)
+{
+    // This is the same loop as PilotPhaseLock.
+    // Frequency is in units of 2**-48 cycles per sample, phase error is Q15.
+    const double freq_scale = ldexp(1.0, 48);
+
+    // Set min/max locking frequencies.
+    m_minfreq = llrint((freq - bandwidth) * freq_scale);
+    m_maxfreq = llrint((freq + bandwidth) * freq_scale);
+
+    // Set valid signal threshold.
+    m_minsignal   = llrint(ldexp(minsignal, phasor_frac_bits));
+    m_lock_delay  = int(20.0 / bandwidth);
+    m_lock_cnt    = 0;
+    m_pilot_level = 0;
+
+    // Create 2nd order filter for I/Q representation of phase error,
+    // as a cascade of two 1st order sections with unit DC gain.
+    // This is less sensitive to rounding than the direct form.
+    double p1 = exp(-1.146 * bandwidth * 2.0 * M_PI);
+    double p2 = exp(-5.331 * bandwidth * 2.0 * M_PI);
+    m_phasor_k1 = llrint(ldexp(1 - p1, coeff_frac_bits));
+    m_phasor_k2 = llrint(ldexp(1 - p2, coeff_frac_bits));
+
+    // Create loop filter to stabilize the loop.
+    double q1 = exp(-0.1153 * bandwidth * 2.0 * M_PI);
+    double b0 = 0.62 * bandwidth;
+    m_loopfilter_b0 = llrint(ldexp(b0, 48 - 15));
+    m_loopfilter_b1 = llrint(ldexp(- b0 * q1, 48 - 15));
+
+    // Initialize frequency and phase.
+    m_freq  = llrint(freq * freq_scale);
+    m_phase = 0;
+
+    m_phasor_i1 = 0;
+    m_phasor_i2 = 0;
+    m_phasor_q1 = 0;
+    m_phasor_q2 = 0;
+    m_loopfilter_x1 = 0;
+
+    // Initialize PPS generator.
+    m_pilot_periods = 0;
+    m_pps_cnt       = 0;
+    m_sample_cnt    = 0;
+}
+
+
+// Process samples.
+void PilotPhaseLockFixed::process(const Sample16Vector& samples_in,
+                                  Sample16Vector& samples_out)
+{
+    const int16_t * sintab = fixed_sine_table();
+    const unsigned int tshift = 32 - fixed_sine_bits;
+    const unsigned int tquarter = 1U << (fixed_sine_bits - 2);
+    const unsigned int tmask = (1U << fixed_sine_bits) - 1;
+
+    unsigned int n = samples_in.size();
+
+    samples_out.resize(n);
+
+    bool was_locked = (m_lock_cnt >= m_lock_delay);
+    m_pps_events.clear();
+
+    if (n > 0)
+        m_pilot_level = INT64_MAX;
+
+    for (unsigned int i = 0; i < n; i++) {
+
+        // Generate locked pilot tone.
+        unsigned int idx = m_phase >> tshift;
+        int32_t psin = sintab[idx];
+        int32_t pcos = sintab[(idx + tquarter) & tmask];
+
+        // Generate double-frequency output.
+        samples_out[i] = sintab[(m_phase >> (tshift - 1)) & tmask];
+
+        // Multiply locked tone with input.
+        // Q14 times Q14 gives Q28, then scale to the phasor format.
+        int32_t x = samples_in[i];
+        int64_t phasor_i = int64_t(psin * x) << (phasor_frac_bits - 28);
+        int64_t phasor_q = int64_t(pcos * x) << (phasor_frac_bits - 28);
+
+        // Run IQ phase error through low-pass filter.
+        m_phasor_i1 += (m_phasor_k1 * (phasor_i - m_phasor_i1))
+                       >> coeff_frac_bits;
+        m_phasor_i2 += (m_phasor_k2 * (m_phasor_i1 - m_phasor_i2))
+                       >> coeff_frac_bits;
+        m_phasor_q1 += (m_phasor_k1 * (phasor_q - m_phasor_q1))
+                       >> coeff_frac_bits;
+        m_phasor_q2 += (m_phasor_k2 * (m_phasor_q1 - m_phasor_q2))
+                       >> coeff_frac_bits;
+        phasor_i = m_phasor_i2;
+        phasor_q = m_phasor_q2;
+
+        // Convert I/Q ratio to estimate of phase error (Q15).
+        int32_t phase_err;
+        if (phasor_i > ((phasor_q < 0) ? -phasor_q : phasor_q)) {
+            // We are within +/- 45 degrees from lock.
+            // Use simple linear approximation of arctan.
+            phase_err = int32_t((phasor_q << 15) / phasor_i);
+        } else if (phasor_q > 0) {
+            // We are lagging more than 45 degrees behind the input.
+            phase_err = 32768;
+        } else {
+            // We are more than 45 degrees ahead of the input.
+            phase_err = -32768;
+        }
+
+        // Detect pilot level (conservative).
+        m_pilot_level = min(m_pilot_level, phasor_i);
+
+        // Run phase error through loop filter and update frequency estimate.
+        m_freq += m_loopfilter_b0 * phase_err
+                  + m_loopfilter_b1 * m_loopfilter_x1;
+        m_loopfilter_x1 = phase_err;
+
+        // Limit frequency to allowable range.
+        m_freq = max(m_minfreq, min(m_maxfreq, m_freq));
+
+        // Update locked phase. The 32-bit phase wraps once per period.
+        uint32_t prev_phase = m_phase;
+        m_phase += uint32_t(m_freq >> 16);
+        if (m_phase < prev_phase) {
+            m_pilot_periods++;
+
+            // Generate pulse-per-second.
+            if (m_pilot_periods == pilot_frequency) {
+                m_pilot_periods = 0;
+                if (was_locked) {
+                    PpsEvent ev;
+                    ev.pps_index      = m_pps_cnt;
                     ev.sample_index   = m_sample_cnt + i;
                     ev.block_position = double(i) / double(n);
                     m_pps_events.push_back(ev);
@@ -285,6 +687,168 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 }
 
 
+/* ****************  class AudioMatrix  **************** */
+
+// Construct audio output stage.
+AudioMatrix::AudioMatrix(double sample_rate_pcm, bool stereo,
+                         double deemphasis)
+    : m_stereo(stereo)
+    , m_gain(1.0)
+    , m_mean(0)
+    , m_rms(0)
+
+    // Construct IirFilterPair for DC blocking and de-emphasis
+    , m_filter(
+        30.0 / sample_rate_pcm,                             // cutoff
+        (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
+
+{
+    // nothing more to do
+}
+
+
+// Process audio samples.
+unsigned int AudioMatrix::process(const Sample * samples, unsigned int n,
+                                  bool stereo_detected, Sample * audio)
+{
+    StoreSample store = { audio };
+    double vsum = 0, vsumsq = 0;
+    unsigned int n_out = process_block(samples, n, stereo_detected, store,
+                                       vsum, vsumsq);
+    set_level(vsum, vsumsq, n_out);
+    return n_out;
+}
+
+
+// Process audio samples and write clipped float samples.
+unsigned int AudioMatrix::process_float(const Sample * samples,
+                                        unsigned int n, bool stereo_detected,
+                                        float * pcm)
+{
+    StoreFloat store = { pcm };
+    double vsum = 0, vsumsq = 0;
+    unsigned int n_out = process_block(samples, n, stereo_detected, store,
+                                       vsum, vsumsq);
+    set_level(vsum, vsumsq, n_out);
+    return n_out;
+}
+
+
+// Process audio samples and write signed 16-bit little-endian samples.
+unsigned int AudioMatrix::process_s16le(const Sample * samples,
+                                        unsigned int n, bool stereo_detected,
+                                        uint8_t * pcm)
+{
+    const DspKernels& kernels = dsp_kernels();
+    unsigned int nch = (m_stereo && stereo_detected) ? 2 : 1;
+
+    // The filters are recursive and run one sample at a time.
+    // Run them over short strips into a buffer that stays in L1 cache,
+    // then convert each strip with the vectorized kernel.
+    Sample buf[2 * s16_strip_length];
+    double vsum = 0, vsumsq = 0;
+    unsigned int n_out = 0;
+
+    for (unsigned int i = 0; i < n; i += s16_strip_length) {
+        unsigned int k = n - i;
+        if (k > s16_strip_length)
+            k = s16_strip_length;
+        StoreSample store = { buf };
+        unsigned int m = process_block(samples + i * nch, k, stereo_detected,
+                                       store, vsum, vsumsq);
+        kernels.convert_s16le(buf, m, 1.0, pcm + 2 * n_out);
+        n_out += m;
+    }
+
+    set_level(vsum, vsumsq, n_out);
+    return n_out;
+}
+
+
+// Filter, mix and store one block of audio; accumulate its level.
+template <class Store>
+unsigned int AudioMatrix::process_block(const Sample * samples,
+                                        unsigned int n, bool stereo_detected,
+                                        Store store,
+                                        double& vsum, double& vsumsq)
+{
+    typedef IirFilterPair::SamplePair SamplePair;
+
+    // Run the filter on a local copy. This keeps its state in
+    // registers, even though the output may alias any memory.
+    // The mono and stereo signals are filtered in the two lanes.
+    IirFilterPair filter = m_filter;
+    const Sample gain = m_gain;
+
+    // Accumulate level in double precision, even if Sample is float.
+    double sum = 0;
+    double sumsq = 0;
+    unsigned int n_out;
+
+    if (!m_stereo) {
+
+        // DC blocking and de-emphasis of mono channel.
+        for (unsigned int i = 0; i < n; i++) {
+            SamplePair x = { samples[i], 0 };
+            Sample m = filter.process_sample(x)[0];
+            sum   += m;
+            sumsq += m * m;
+            store(i, gain * m);
+        }
+        n_out = n;
+
+    } else if (!stereo_detected) {
+
+        // Without pilot lock there is no stereo input and the mono signal
+        // appears in both channels. The stereo filter lane runs on zeros,
+        // so it starts from a settled state when the pilot locks.
+        for (unsigned int i = 0; i < n; i++) {
+            SamplePair x = { samples[i], 0 };
+            Sample m = filter.process_sample(x)[0];
+            sum   += 2 * m;
+            sumsq += 2 * (m * m);
+            store(2*i,   gain * m);
+            store(2*i+1, gain * m);
+        }
+        n_out = 2 * n;
+
+    } else {
+
+        // DC blocking and de-emphasis of both channels,
+        // then extract left/right channels from mono/stereo signals.
+        for (unsigned int i = 0; i < n; i++) {
+            SamplePair x = { samples[2*i], samples[2*i+1] };
+            SamplePair y = filter.process_sample(x);
+            Sample m = y[0];
+            Sample s = y[1];
+            Sample l = m + s;
+            Sample r = m - s;
+            sum   += l + r;
+            sumsq += l * l + r * r;
+            store(2*i,   gain * l);
+            store(2*i+1, gain * r);
+        }
+        n_out = 2 * n;
+    }
+
+    m_filter = filter;
+
+    vsum   += sum;
+    vsumsq += sumsq;
+    return n_out;
+}
+
+
+// Update the audio level from accumulated sums over n samples.
+void AudioMatrix::set_level(double vsum, double vsumsq, unsigned int n)
+{
+    if (n > 0) {
+        m_mean = vsum / n;
+        m_rms  = sqrt(vsumsq / n);
+    }
+}
+
+
 /* ****************  class FmDecoder  **************** */
 
 FmDecoder::FmDecoder(double sample_rate_if,
@@ -295,188 +859,589 @@ FmDecoder::FmDecoder(double sample_rate_if,
                      double bandwidth_if,
                      double freq_dev,
                      double bandwidth_pcm,
-                     unsigned int downsample)
+                     unsigned int downsample,
+                     unsigned int block_length,
+                     bool   huge_pages)
 
     // Initialize member fields
     : m_sample_rate_if(sample_rate_if)
     , m_sample_rate_baseband(sample_rate_if / downsample)
-    , m_tuning_table_size(64)
-    , m_tuning_shift(lrint(-64.0 * tuning_offset / sample_rate_if))
     , m_freq_dev(freq_dev)
-    , m_downsample(downsample)
     , m_stereo_enabled(stereo)
     , m_stereo_detected(false)
+    , m_block_length(block_length)
+    , m_strip_length(default_strip_length)
     , m_if_level(0)
     , m_baseband_mean(0)
     , m_baseband_level(0)
 
-    // Construct FineTuner
-    , m_finetuner(m_tuning_table_size, m_tuning_shift)
-
-    // Construct LowPassFilterFirIQ
-    , m_iffilter(10, bandwidth_if / sample_rate_if)
+    // Construct DownconverterIQ
+    , m_downconverter(
+        -tuning_offset / sample_rate_if,                    // freq_shift
+        if_filter_order(downsample),                        // filter_order
+        if_filter_cutoff(sample_rate_if, bandwidth_if,
+                         downsample),                       // cutoff
+        downsample)                                         // downsample
 
     // Construct PhaseDiscriminator
-    , m_phasedisc(freq_dev / sample_rate_if)
-
-    // Construct DownsampleFilter for baseband
-    , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
+    , m_phasedisc(freq_dev / m_sample_rate_baseband)
 
     // Construct PilotPhaseLock
     , m_pilotpll(pilot_freq / m_sample_rate_baseband,       // freq
                  50 / m_sample_rate_baseband,               // bandwidth
                  0.04)                                      // minsignal
 
-    // Construct DownsampleFilter for mono channel
-    , m_resample_mono(
+    // Construct DownsampleFilter for mono and stereo channels
+    , m_resample(
         int(m_sample_rate_baseband / 1000.0),               // filter_order
         bandwidth_pcm / m_sample_rate_baseband,             // cutoff
         m_sample_rate_baseband / sample_rate_pcm,           // downsample
-        false)                                              // integer_factor
+        is_integer_factor(m_sample_rate_baseband / sample_rate_pcm),
+        stereo ? 2 : 1)                                     // channels
 
-    // Construct DownsampleFilter for stereo channel
-    , m_resample_stereo(
-        int(m_sample_rate_baseband / 1000.0),               // filter_order
-        bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-        m_sample_rate_baseband / sample_rate_pcm,           // downsample
-        false)                                              // integer_factor
+    // Construct AudioMatrix
+    , m_audio(sample_rate_pcm, stereo, deemphasis)
 
-    // Construct HighPassFilterIir
-    , m_dcblock_mono(30.0 / sample_rate_pcm)
-    , m_dcblock_stereo(30.0 / sample_rate_pcm)
+    // Construct Arena for the working buffers
+    , m_arena(get_arena_size(), huge_pages)
 
-    // Construct LowPassFilterRC
-    , m_deemph_mono(
-        (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
-    , m_deemph_stereo(
-        (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
+{
+    assert(block_length > 0);
+
+    // Allocate working buffers for one block.
+    unsigned int n_if_max = m_downconverter.get_max_output_size(block_length);
+    unsigned int n_audio_max = m_resample.get_max_output_size(n_if_max);
+    m_buf_iffiltered_re = m_arena.allocate<IQSample::value_type>(n_if_max);
+    m_buf_iffiltered_im = m_arena.allocate<IQSample::value_type>(n_if_max);
+    m_buf_baseband   = m_arena.allocate<Sample>(n_if_max);
+    m_buf_audio      = m_arena.allocate<Sample>((stereo ? 2 : 1) * n_audio_max);
+    if (stereo) {
+        m_buf_rawstereo = m_arena.allocate<Sample>(n_if_max);
+        m_buf_mpx       = m_arena.allocate<Sample>(2 * n_if_max);
+    } else {
+        m_buf_rawstereo = nullptr;
+        m_buf_mpx       = nullptr;
+    }
 
+    set_strip_length(default_strip_length);
+}
+
+
+// Return the number of bytes needed for the working buffers.
+size_t FmDecoder::get_arena_size() const
 {
-    // nothing more to do
+    unsigned int n_if_max = m_downconverter.get_max_output_size(m_block_length);
+    unsigned int n_audio_max = m_resample.get_max_output_size(n_if_max);
+
+    size_t size = 2 * Arena::buffer_size<IQSample::value_type>(n_if_max)
+                  + Arena::buffer_size<Sample>(n_if_max);
+    if (m_stereo_enabled) {
+        size += Arena::buffer_size<Sample>(2 * n_audio_max)
+                + Arena::buffer_size<Sample>(n_if_max)
+                + Arena::buffer_size<Sample>(2 * n_if_max);
+    } else {
+        size += Arena::buffer_size<Sample>(n_audio_max);
+    }
+
+    return size;
+}
+
+
+// Return the delay of the decoder filters.
+double FmDecoder::get_delay() const
+{
+    // The phase discriminator adds half a baseband sample.
+    return m_downconverter.get_delay() / m_sample_rate_if
+           + (0.5 + m_resample.get_delay()) / m_sample_rate_baseband;
+}
+
+
+// Return the order of the IF channel filter.
+unsigned int FmDecoder::if_filter_order(unsigned int downsample)
+{
+    return (downsample > 1) ? 32 * downsample : 10;
+}
+
+
+// Return the IF channel filter cutoff relative to the IF sample rate.
+double FmDecoder::if_filter_cutoff(double sample_rate_if,
+                                   double bandwidth_if,
+                                   unsigned int downsample)
+{
+    double cutoff = bandwidth_if / sample_rate_if;
+    if (downsample > 1)
+        cutoff = max(cutoff, min(0.5 / downsample,
+                                 max_bandwidth_if / sample_rate_if));
+    return cutoff;
+}
+
+
+// Return the maximum number of audio samples for n input samples.
+unsigned int FmDecoder::get_max_output_size(unsigned int n) const
+{
+    // Longer blocks are decoded in pieces of m_block_length samples.
+    unsigned int n_audio = 0;
+    for (unsigned int i = 0; i < n; i += m_block_length) {
+        unsigned int m = min(m_block_length, n - i);
+        unsigned int n_if = m_downconverter.get_max_output_size(m);
+        n_audio += m_resample.get_max_output_size(n_if);
+    }
+    return m_stereo_enabled ? 2 * n_audio : n_audio;
 }
 
 
+// Process IQ samples and return audio samples.
 void FmDecoder::process(const IQSampleVector& samples_in,
                         SampleVector& audio)
 {
-    // Fine tuning.
-    m_finetuner.process(samples_in, m_buf_iftuned);
+    audio.resize(get_max_output_size(samples_in.size()));
+    unsigned int n_out = process(samples_in.data(), samples_in.size(),
+                                 audio.data());
+    audio.resize(n_out);
+}
 
-    // Low pass filter to isolate station.
-    m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
 
-    // Measure IF level.
-    double if_rms = rms_level_approx(m_buf_iffiltered);
-    m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
+// Process n IQ samples and return the number of audio samples.
+unsigned int FmDecoder::process(const IQSample * samples_in, unsigned int n,
+                                Sample * audio)
+{
+    unsigned int n_out = 0;
+
+    // Longer blocks are decoded in pieces of m_block_length samples.
+    for (unsigned int i = 0; i < n; i += m_block_length) {
+        unsigned int m = min(m_block_length, n - i);
+        unsigned int n_audio = demodulate(samples_in + i, m);
+        uint64_t t = StageCounters::now();
+        n_out += m_audio.process(m_buf_audio, n_audio, m_stereo_detected,
+                                 audio + n_out);
+        m_stage_counters.add(STAGE_AUDIO_OUTPUT, t, n_audio);
+    }
 
-    // Extract carrier frequency.
-    m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
+    return n_out;
+}
 
-    // Downsample baseband signal to reduce processing.
-    if (m_downsample > 1) {
-        SampleVector tmp(move(m_buf_baseband));
-        m_resample_baseband.process(tmp, m_buf_baseband);
+
+// Process n IQ samples and write float PCM audio.
+unsigned int FmDecoder::process_float(const IQSample * samples_in,
+                                      unsigned int n, float * pcm)
+{
+    unsigned int n_out = 0;
+
+    // Longer blocks are decoded in pieces of m_block_length samples.
+    for (unsigned int i = 0; i < n; i += m_block_length) {
+        unsigned int m = min(m_block_length, n - i);
+        unsigned int n_audio = demodulate(samples_in + i, m);
+        uint64_t t = StageCounters::now();
+        n_out += m_audio.process_float(m_buf_audio, n_audio,
+                                       m_stereo_detected, pcm + n_out);
+        m_stage_counters.add(STAGE_AUDIO_OUTPUT, t, n_audio);
     }
 
-    // Measure baseband level.
-    double baseband_mean, baseband_rms;
-    samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
-    m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
-    m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
+    return n_out;
+}
 
-    // Extract mono audio signal.
-    m_resample_mono.process(m_buf_baseband, m_buf_mono);
 
-    // DC blocking and de-emphasis.
-    m_dcblock_mono.process_inplace(m_buf_mono);
-    m_deemph_mono.process_inplace(m_buf_mono);
+// Process n IQ samples and write signed 16-bit little-endian PCM audio.
+unsigned int FmDecoder::process_s16le(const IQSample * samples_in,
+                                      unsigned int n, uint8_t * pcm)
+{
+    unsigned int n_out = 0;
+
+    // Longer blocks are decoded in pieces of m_block_length samples.
+    for (unsigned int i = 0; i < n; i += m_block_length) {
+        unsigned int m = min(m_block_length, n - i);
+        unsigned int n_audio = demodulate(samples_in + i, m);
+        uint64_t t = StageCounters::now();
+        n_out += m_audio.process_s16le(m_buf_audio, n_audio,
+                                       m_stereo_detected, pcm + 2 * n_out);
+        m_stage_counters.add(STAGE_AUDIO_OUTPUT, t, n_audio);
+    }
 
-    if (m_stereo_enabled) {
+    return n_out;
+}
 
-        // Lock on stereo pilot.
-        m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
-        m_stereo_detected = m_pilotpll.locked();
 
-        // Demodulate stereo signal.
-        demod_stereo(m_buf_baseband, m_buf_rawstereo);
+// Return accumulated time per decoder stage.
+vector<StageStats> FmDecoder::get_stage_stats() const
+{
+    vector<StageStats> stats;
+    m_downconverter.get_stage_counters().merge_into(stats);
+    m_stage_counters.merge_into(stats);
+    return stats;
+}
 
-        // Extract audio and downsample.
-        // NOTE: This MUST be done even if no stereo signal is detected yet,
-        // because the downsamplers for mono and stereo signal must be
-        // kept in sync.
-        m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo);
 
-        // DC blocking and de-emphasis.
-        m_dcblock_stereo.process_inplace(m_buf_stereo);
-        m_deemph_stereo.process_inplace(m_buf_stereo);
+// Clear the stage timing counters.
+void FmDecoder::reset_stage_stats()
+{
+    m_downconverter.get_stage_counters().reset();
+    m_stage_counters.reset();
+}
 
-        if (m_stereo_detected) {
 
-            // Extract left/right channels from mono/stereo signals.
-            stereo_to_left_right(m_buf_mono, m_buf_stereo, audio);
+// Set the number of IQ samples per strip.
+void FmDecoder::set_strip_length(unsigned int n)
+{
+    // Each resampler call transforms whole FFT blocks. Shorter strips
+    // would waste more time in the resampler than they save in cache.
+    unsigned int fft_step = m_resample.get_fft_step();
+    if (n != 0 && fft_step != 0) {
+        unsigned int downsample = lrint(m_sample_rate_if /
+                                        m_sample_rate_baseband);
+        n = max(n, 2 * fft_step * downsample);
+    }
 
-        } else {
+    unsigned int chunk = DownconverterIQ::chunk_length;
+    m_strip_length = (n + chunk - 1) / chunk * chunk;
+}
 
-            // Duplicate mono signal in left/right channels.
-            mono_to_left_right(m_buf_mono, audio);
 
+// Demodulate and resample n IQ samples into the audio buffer.
+unsigned int FmDecoder::demodulate(const IQSample * samples_in, unsigned int n)
+{
+    // Walk the decode chain in strips, so the intermediate buffers
+    // between stages stay in cache.
+    unsigned int strip = n;
+    if (m_strip_length != 0 && m_strip_length < n)
+        strip = m_strip_length;
+
+    // The working buffers are sized for one block.
+    assert(n <= m_block_length);
+    unsigned int n_if = m_downconverter.get_output_size(n);
+
+    unsigned int if_offset = 0;
+    unsigned int n_audio = 0;
+    double baseband_sum = 0, baseband_sumsq = 0;
+
+    for (unsigned int i = 0; i < n; i += strip) {
+        unsigned int m = min(strip, n - i);
+
+        // Fine tuning, low pass filter to isolate station and downsample
+        // IF signal to reduce processing. The IF signal is kept in split
+        // layout for the phase discriminator.
+        unsigned int k = m_downconverter.process(samples_in + i, m,
+                                                 m_buf_iffiltered_re,
+                                                 m_buf_iffiltered_im);
+        assert(if_offset + k <= n_if);
+        uint64_t t = StageCounters::now();
+
+        // Measure IF level over a prefix of the block.
+        // Short strips limit the prefix to the first strip.
+        if (i == 0 && k > 0) {
+            double if_rms = rms_level_approx(m_buf_iffiltered_re,
+                                             m_buf_iffiltered_im,
+                                             min(n_if, 64 * k));
+            m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
+            t = m_stage_counters.add(STAGE_LEVELS, t, min(n_if, 64 * k));
         }
 
-    } else {
+        // Extract carrier frequency.
+        const Sample * bb = m_buf_baseband;
+        m_phasedisc.process(m_buf_iffiltered_re, m_buf_iffiltered_im, k,
+                            m_buf_baseband);
+        t = m_stage_counters.add(STAGE_DISCRIMINATOR, t, k);
+
+        // Accumulate baseband level.
+        samples_sum_sumsq(bb, k, baseband_sum, baseband_sumsq);
+        t = m_stage_counters.add(STAGE_LEVELS, t, k);
+
+        if (!m_stereo_enabled) {
+            // Extract mono audio signal and downsample.
+            // DC blocking and de-emphasis are done by the audio output stage.
+            n_audio += m_resample.process(bb, k, m_buf_audio + n_audio);
+            m_stage_counters.add(STAGE_RESAMPLER, t, k);
+            if_offset += k;
+            continue;
+        }
+
+        // Lock on stereo pilot.
+        // The lock status only changes at the end of the block.
+        m_pilotpll.process_part(bb, k, m_buf_rawstereo, if_offset, n_if);
+        if_offset += k;
+        bool locked = m_pilotpll.locked();
+
+        // Convert frames of earlier strips if the lock status changed.
+        if (locked != m_stereo_detected) {
+            Sample * buf = m_buf_audio;
+            if (locked) {
+                // Frames before pilot lock have no stereo signal.
+                for (unsigned int j = n_audio; j-- > 0; ) {
+                    buf[2*j+1] = 0;
+                    buf[2*j]   = buf[j];
+                }
+            } else {
+                // Drop the stereo signal after pilot loss.
+                for (unsigned int j = 0; j < n_audio; j++)
+                    buf[j] = buf[2*j];
+            }
+            m_stereo_detected = locked;
+        }
+        t = m_stage_counters.add(STAGE_PILOT_PLL, t, k);
+
+        // Frames hold the mono and stereo signal only while locked.
+        Sample * audio = m_buf_audio + n_audio * (locked ? 2 : 1);
+
+        if (!locked) {
+            // Without pilot lock the stereo signal is not used.
+            // Extract only mono audio, but demodulate the last few stereo
+            // samples to keep the resampler history valid for when the
+            // pilot locks.
+            n_audio += m_resample.process_first(bb, k, audio);
+            unsigned int h = min(k, m_resample.get_history_length());
+            const Sample * rawstereo = m_buf_rawstereo + k - h;
+            Sample * stereo = m_buf_mpx;
+            for (unsigned int j = 0; j < h; j++)
+                stereo[j] = rawstereo[j] * (2 * bb[k-h+j]);
+            m_resample.set_history(1, stereo, h);
+            m_stage_counters.add(STAGE_RESAMPLER, t, k);
+            continue;
+        }
 
-        // Just return mono channel.
-        audio = move(m_buf_mono);
+        // Demodulate stereo signal.
+        demod_stereo(bb, m_buf_rawstereo, k, m_buf_mpx);
+        t = m_stage_counters.add(STAGE_STEREO_DEMOD, t, k);
+
+        // Extract mono and L-R audio and downsample both channels together.
+        // The resampler runs a single phase accumulator for both channels,
+        // so mono and stereo output always stay in sync.
+        n_audio += m_resample.process(m_buf_mpx, k, audio);
+        m_stage_counters.add(STAGE_RESAMPLER, t, k);
+    }
 
+    assert(if_offset == n_if);
+
+    // Measure baseband level.
+    if (n_if > 0) {
+        double baseband_mean = baseband_sum / n_if;
+        double baseband_rms  = sqrt(baseband_sumsq / n_if);
+        m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
+        m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
     }
+
+    return n_audio;
 }
 
 
 // Demodulate stereo L-R signal.
-void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
-                             SampleVector& samples_rawstereo)
+void FmDecoder::demod_stereo(const Sample * samples_baseband,
+                             const Sample * samples_rawstereo, unsigned int n,
+                             Sample * samples_mpx)
 {
     // Just multiply the baseband signal with the double-frequency pilot.
     // And multiply by two to get the full amplitude.
     // That's all.
 
-    unsigned int n = samples_baseband.size();
-    assert(n == samples_rawstereo.size());
-
     for (unsigned int i = 0; i < n; i++) {
-        samples_rawstereo[i] *= 2 * samples_baseband[i];
+        samples_mpx[2*i]   = samples_baseband[i];
+        samples_mpx[2*i+1] = samples_rawstereo[i] * (2 * samples_baseband[i]);
     }
 }
 
 
-// Duplicate mono signal in left/right channels.
-void FmDecoder::mono_to_left_right(const SampleVector& samples_mono,
-                                   SampleVector& audio)
+/* ****************  class FmDecoderFixed  **************** */
+
+FmDecoderFixed::FmDecoderFixed(double sample_rate_if,
+                               double tuning_offset,
+                               double sample_rate_pcm,
+                               bool   stereo,
+                               double deemphasis,
+                               double bandwidth_if,
+                               double freq_dev,
+                               double bandwidth_pcm,
+                               unsigned int downsample)
+
+    // Initialize member fields
+    : m_sample_rate_if(sample_rate_if)
+    , m_sample_rate_baseband(sample_rate_if / downsample)
+    , m_freq_dev(freq_dev)
+    , m_stereo_enabled(stereo)
+    , m_stereo_detected(false)
+    , m_if_level(0)
+    , m_baseband_mean(0)
+    , m_baseband_level(0)
+
+    // Construct DownconverterFixed
+    , m_downconverter(
+        -tuning_offset / sample_rate_if,                    // freq_shift
+        FmDecoder::if_filter_order(downsample),             // filter_order
+        FmDecoder::if_filter_cutoff(sample_rate_if, bandwidth_if,
+                                    downsample),            // cutoff
+        downsample)                                         // downsample
+
+    // Construct PhaseDiscriminatorFixed
+    , m_phasedisc(freq_dev / m_sample_rate_baseband)
+
+    // Construct PilotPhaseLockFixed
+    , m_pilotpll(FmDecoder::pilot_freq / m_sample_rate_baseband, // freq
+                 50 / m_sample_rate_baseband,               // bandwidth
+                 0.04)                                      // minsignal
+
+    // Construct DownsampleFilterFixed for mono channel
+    , m_resample_mono(
+        int(m_sample_rate_baseband / 1000.0),               // filter_order
+        bandwidth_pcm / m_sample_rate_baseband,             // cutoff
+        m_sample_rate_baseband / sample_rate_pcm,           // downsample
+        is_integer_factor(m_sample_rate_baseband / sample_rate_pcm))
+
+    // Construct DownsampleFilterFixed for stereo channel
+    , m_resample_stereo(
+        int(m_sample_rate_baseband / 1000.0),               // filter_order
+        bandwidth_pcm / m_sample_rate_baseband,             // cutoff
+        m_sample_rate_baseband / sample_rate_pcm,           // downsample
+        is_integer_factor(m_sample_rate_baseband / sample_rate_pcm))
+
+    // Construct AudioMatrix
+    , m_audio(sample_rate_pcm, stereo, deemphasis)
+
+{
+    // nothing more to do
+}
+
+
+// Process raw IQ data and return audio samples.
+void FmDecoderFixed::process(const RawSampleVector& samples_in,
+                             SampleVector& audio)
 {
-    unsigned int n = samples_mono.size();
+    unsigned int n_audio = demodulate(samples_in);
+    uint64_t t = StageCounters::now();
+    audio.resize(m_stereo_enabled ? 2 * n_audio : n_audio);
+    m_audio.process(m_buf_audio.data(), n_audio,
+                    m_stereo_detected, audio.data());
+    m_stage_counters.add(STAGE_AUDIO_OUTPUT, t, n_audio);
+}
 
-    audio.resize(2*n);
-    for (unsigned int i = 0; i < n; i++) {
-        Sample m = samples_mono[i];
-        audio[2*i]   = m;
-        audio[2*i+1] = m;
+
+// Process raw IQ data and return signed 16-bit little-endian audio.
+void FmDecoderFixed::process_s16le(const RawSampleVector& samples_in,
+                                   vector<uint8_t>& pcm)
+{
+    unsigned int n_audio = demodulate(samples_in);
+    uint64_t t = StageCounters::now();
+    pcm.resize(2 * (m_stereo_enabled ? 2 * n_audio : n_audio));
+    m_audio.process_s16le(m_buf_audio.data(), n_audio,
+                          m_stereo_detected, pcm.data());
+    m_stage_counters.add(STAGE_AUDIO_OUTPUT, t, n_audio);
+}
+
+
+// Return the delay of the decoder filters.
+double FmDecoderFixed::get_delay() const
+{
+    // The phase discriminator adds half a baseband sample.
+    return m_downconverter.get_delay() / m_sample_rate_if
+           + (0.5 + m_resample_mono.get_delay()) / m_sample_rate_baseband;
+}
+
+
+// Return accumulated time per decoder stage.
+vector<StageStats> FmDecoderFixed::get_stage_stats() const
+{
+    vector<StageStats> stats;
+    m_downconverter.get_stage_counters().merge_into(stats);
+    m_stage_counters.merge_into(stats);
+    return stats;
+}
+
+
+// Clear the stage timing counters.
+void FmDecoderFixed::reset_stage_stats()
+{
+    m_downconverter.get_stage_counters().reset();
+    m_stage_counters.reset();
+}
+
+
+// Demodulate and resample raw IQ data into the audio buffer.
+unsigned int FmDecoderFixed::demodulate(const RawSampleVector& samples_in)
+{
+    // Fine tuning, low pass filter to isolate station and downsample
+    // IF signal to reduce processing.
+    m_downconverter.process(samples_in, m_buf_iffiltered);
+    unsigned int n_if = m_buf_iffiltered.size();
+    uint64_t t = StageCounters::now();
+
+    // Measure IF level.
+    if (n_if > 0) {
+        double if_rms = rms_level_approx(m_buf_iffiltered);
+        m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
     }
+    t = m_stage_counters.add(STAGE_LEVELS, t, n_if);
+
+    // Extract carrier frequency.
+    m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
+    t = m_stage_counters.add(STAGE_DISCRIMINATOR, t, n_if);
+
+    // Measure baseband level.
+    if (n_if > 0) {
+        double baseband_mean, baseband_rms;
+        samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
+        m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
+        m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
+    }
+    t = m_stage_counters.add(STAGE_LEVELS, t, n_if);
+
+    // The audio buffer holds stereo frames only while the pilot is locked.
+    unsigned int nchannel = 1;
+
+    if (m_stereo_enabled) {
+
+        // Lock on stereo pilot.
+        m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
+        m_stereo_detected = m_pilotpll.locked();
+        t = m_stage_counters.add(STAGE_PILOT_PLL, t, n_if);
+
+        if (m_stereo_detected) {
+            // Demodulate stereo signal.
+            demod_stereo(m_buf_baseband, m_buf_rawstereo, 0);
+            t = m_stage_counters.add(STAGE_STEREO_DEMOD, t, n_if);
+
+            // Extract audio and downsample.
+            m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo16);
+            nchannel = 2;
+        } else {
+            // Without pilot lock the stereo signal is not used.
+            // Demodulate only the last few stereo samples and skip the
+            // stereo resampler over the block, so that it stays in sync
+            // with the mono resampler for when the pilot locks.
+            unsigned int h = min(n_if, m_resample_stereo.get_history_length());
+            demod_stereo(m_buf_baseband, m_buf_rawstereo, n_if - h);
+            m_buf_stereo16.assign(m_buf_rawstereo.end() - h,
+                                  m_buf_rawstereo.end());
+            m_resample_stereo.skip(n_if, m_buf_stereo16);
+            t = m_stage_counters.add(STAGE_STEREO_DEMOD, t, h);
+        }
+    }
+
+    // Extract mono audio signal.
+    m_resample_mono.process(m_buf_baseband, m_buf_mono16);
+    unsigned int n_audio = m_buf_mono16.size();
+    grow_buffer(m_buf_audio, nchannel * n_audio);
+    samples_from_fixed(m_buf_mono16, m_buf_audio.data(), nchannel);
+
+    if (nchannel == 2) {
+        assert(m_buf_stereo16.size() == n_audio);
+        samples_from_fixed(m_buf_stereo16, m_buf_audio.data() + 1, 2);
+    }
+    m_stage_counters.add(STAGE_RESAMPLER, t, n_if);
+
+    // DC blocking and de-emphasis are done by the audio output stage.
+    return n_audio;
 }
 
 
-// Extract left/right channels from mono/stereo signals.
-void FmDecoder::stereo_to_left_right(const SampleVector& samples_mono,
-                                     const SampleVector& samples_stereo,
-                                     SampleVector& audio)
+// Demodulate stereo L-R signal from sample offset to the end.
+void FmDecoderFixed::demod_stereo(const Sample16Vector& samples_baseband,
+                                  Sample16Vector& samples_rawstereo,
+                                  unsigned int offset)
 {
-    unsigned int n = samples_mono.size();
-    assert(n == samples_stereo.size());
+    // Multiply the baseband signal with the double-frequency pilot,
+    // and multiply by two to get the full amplitude.
+    unsigned int n = samples_baseband.size();
+    assert(n == samples_rawstereo.size());
 
-    audio.resize(2*n);
-    for (unsigned int i = 0; i < n; i++) {
-        Sample m = samples_mono[i];
-        Sample s = samples_stereo[i];
-        audio[2*i]   = m + s;
-        audio[2*i+1] = m - s;
+    for (unsigned int i = offset; i < n; i++) {
+        int32_t y = int32_t(samples_rawstereo[i]) * samples_baseband[i];
+        samples_rawstereo[i] = fixed_round_sat(y, fixed_frac_bits - 1);
     }
 }
 
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "RatePlanner.h"
+#include "Filter.h"
+#include "FmDecode.h"
+
+using namespace std;
+
+
+// Timings of the floating-point decoder in nanoseconds.
+static const double ns_tuner         = 1.3;  // per IF sample
+static const double ns_halfband      = 0.5;  // per half-band input sample
+static const double ns_decim2_tap    = 0.17; // per tap and output, factor 2
+static const double ns_fir_output    = 14.0; // per output, other factors
+static const double ns_fir_tap       = 0.04; // per tap and output
+static const double ns_demod_mono    = 7.0;  // per baseband sample
+static const double ns_demod_stereo  = 23.0; // per baseband sample
+static const double ns_fft_mono      = 13.0; // per baseband sample
+static const double ns_fft_stereo    = 22.0; // per baseband sample
+static const double ns_direct_mono   = 0.12; // per multiplication
+static const double ns_direct_stereo = 0.7;  // per multiplication, strided
+
+// Relative extra cost accepted for a more exact resampling algorithm.
+static const double mode_margin = 1.1;
+
+
+/* ****************  class RatePlanner  **************** */
+
+// Definitions for uses by reference, such as min().
+constexpr double RatePlanner::min_baseband_rate;
+constexpr double RatePlanner::default_min_if_rate;
+constexpr double RatePlanner::default_max_if_rate;
+constexpr double RatePlanner::default_if_tolerance;
+
+
+// Construct planner.
+RatePlanner::RatePlanner(double sample_rate_pcm, bool stereo)
+    : m_sample_rate_pcm(sample_rate_pcm)
+    , m_stereo(stereo)
+    , m_min_if_rate(default_min_if_rate)
+    , m_max_if_rate(default_max_if_rate)
+    , m_if_tolerance(default_if_tolerance)
+{
+    assert(sample_rate_pcm > 0 && sample_rate_pcm < min_baseband_rate);
+}
+
+
+// Set the range of supported IF sample rates.
+void RatePlanner::set_if_range(double min_rate, double max_rate)
+{
+    assert(min_rate <= max_rate);
+    m_min_if_rate = min_rate;
+    m_max_if_rate = max_rate;
+}
+
+
+// Set the allowed deviation from the preferred IF rate.
+void RatePlanner::set_if_tolerance(double tolerance)
+{
+    m_if_tolerance = tolerance;
+}
+
+
+// Return the cheapest plan for a fixed IF sample rate.
+RatePlan RatePlanner::plan_fixed(double sample_rate_if) const
+{
+    // The station occupies only +/- 100 kHz of the IF signal, so we can
+    // downsample to ~ 250 kS/s before demodulation without loss of
+    // information. Less decimation may still be cheaper when it leaves
+    // a factor that the downconverter handles in half-band stages.
+    unsigned int max_downsample = max(1, int(sample_rate_if / min_baseband_rate));
+    RatePlan best = make_plan(sample_rate_if, max_downsample);
+    for (unsigned int d = 1; d < max_downsample; d++) {
+        RatePlan p = make_plan(sample_rate_if, d);
+        if (p.cost < best.cost)
+            best = p;
+    }
+    return best;
+}
+
+
+// Return a plan with an IF sample rate near the preferred rate.
+RatePlan RatePlanner::plan(double preferred_if, double max_cost) const
+{
+    double min_if = max(m_min_if_rate, preferred_if * (1 - m_if_tolerance));
+    double max_if = min(m_max_if_rate, preferred_if * (1 + m_if_tolerance));
+
+    RatePlan best = plan_fixed(min(m_max_if_rate,
+                                   max(m_min_if_rate, preferred_if)));
+
+    // Try IF rates that are an integer multiple (k * d) of the audio rate,
+    // decimated by d to a baseband rate of k times the audio rate.
+    unsigned int min_k = ceil(min_baseband_rate / m_sample_rate_pcm);
+    for (unsigned int d = 1; d * min_k * m_sample_rate_pcm <= max_if; d++) {
+        for (unsigned int k = min_k; k * d * m_sample_rate_pcm <= max_if; k++) {
+            double rate = k * d * m_sample_rate_pcm;
+            if (rate < min_if)
+                continue;
+            RatePlan p = make_plan(rate, d);
+            if (is_better(p, best, max_cost))
+                best = p;
+        }
+    }
+
+    return best;
+}
+
+
+// Return a short name for a resampling algorithm.
+const char * RatePlanner::get_mode_name(ResampleMode mode)
+{
+    switch (mode) {
+        case RESAMPLE_INTEGER:      return "integer";
+        case RESAMPLE_RATIONAL:     return "rational";
+        case RESAMPLE_FRACTIONAL:   return "fractional";
+    }
+    return "unknown";
+}
+
+
+// Fill in a plan and predict its cost.
+RatePlan RatePlanner::make_plan(double sample_rate_if,
+                                unsigned int downsample) const
+{
+    RatePlan p;
+    p.sample_rate_if = sample_rate_if;
+    p.downsample = downsample;
+    p.halfband_stages = DownconverterIQ::count_halfband_stages(
+        FmDecoder::if_filter_cutoff(sample_rate_if,
+                                    FmDecoder::default_bandwidth_if,
+                                    downsample),
+        downsample);
+    p.sample_rate_baseband = sample_rate_if / downsample;
+    p.sample_rate_pcm = m_sample_rate_pcm;
+
+    // Same choices as the audio resampler of FmDecoder.
+    double resample = p.sample_rate_baseband / m_sample_rate_pcm;
+    if (DownsampleFilter::find_rational(resample, p.resample_up,
+                                        p.resample_down)) {
+        p.resample_mode = (p.resample_up == 1) ? RESAMPLE_INTEGER
+                                               : RESAMPLE_RATIONAL;
+    } else {
+        p.resample_mode = RESAMPLE_FRACTIONAL;
+        p.resample_up = 0;
+        p.resample_down = 0;
+    }
+    p.resample_fft = DownsampleFilter::prefers_fft(
+        int(p.sample_rate_baseband / 1000.0), resample,
+        p.resample_mode == RESAMPLE_INTEGER, m_stereo ? 2 : 1);
+
+    p.cost = predict_cost(p);
+    return p;
+}
+
+
+// Return the predicted cost of a plan in CPU cores.
+double RatePlanner::predict_cost(const RatePlan& plan) const
+{
+    // Downconverter, per IF sample: the fine tuner, the half-band
+    // stages at decreasing rates and the final FIR filter.
+    unsigned int order = FmDecoder::if_filter_order(plan.downsample);
+    double rate = 1.0;
+    double ns_if = ns_tuner;
+    for (unsigned int i = 0; i < plan.halfband_stages; i++) {
+        ns_if += ns_halfband * rate;
+        rate /= 2;
+        order /= 2;
+    }
+    unsigned int final_downsample = plan.downsample >> plan.halfband_stages;
+    double ns_output = (final_downsample == 2) ?
+                       ns_decim2_tap * (order + 1) :
+                       ns_fir_output + ns_fir_tap * (order + 1);
+    ns_if += ns_output * rate / final_downsample;
+
+    // Demodulator and audio resampler, per baseband sample.
+    // With FFT convolution the resampling algorithm hardly matters;
+    // the direct filter costs its multiplications per output.
+    double ns_baseband = m_stereo ? ns_demod_stereo : ns_demod_mono;
+    if (plan.resample_fft) {
+        ns_baseband += m_stereo ? ns_fft_stereo : ns_fft_mono;
+    } else {
+        unsigned int resample_order = int(plan.sample_rate_baseband / 1000.0);
+        unsigned int nmul = (plan.resample_mode == RESAMPLE_INTEGER) ?
+                            resample_order :
+                            (plan.resample_mode == RESAMPLE_RATIONAL) ?
+                            resample_order + 1 :
+                            2 * (resample_order + 1);
+        double ns_mul = m_stereo ? 2 * ns_direct_stereo : ns_direct_mono;
+        ns_baseband += ns_mul * nmul
+                       * plan.sample_rate_pcm / plan.sample_rate_baseband;
+    }
+
+    return 1.0e-9 * (ns_if * plan.sample_rate_if
+                     + ns_baseband * plan.sample_rate_baseband);
+}
+
+
+// Return true if plan a is better than plan b.
+bool RatePlanner::is_better(const RatePlan& a, const RatePlan& b,
+                            double max_cost)
+{
+    bool a_fits = (a.cost <= max_cost);
+    bool b_fits = (b.cost <= max_cost);
+    if (a_fits != b_fits)
+        return a_fits;
+
+    // Exact resampling is worth a slightly higher cost.
+    if (a.resample_mode < b.resample_mode)
+        return a.cost < mode_margin * b.cost;
+    if (a.resample_mode > b.resample_mode)
+        return mode_margin * a.cost < b.cost;
+    return a.cost < b.cost;
+}
+
+/* end */
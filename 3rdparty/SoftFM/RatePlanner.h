@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTFM_RATEPLANNER_H
+#define SOFTFM_RATEPLANNER_H
+
+
+/** Algorithm used by the audio DownsampleFilter. */
+enum ResampleMode {
+    RESAMPLE_INTEGER,           // integer downsample factor
+    RESAMPLE_RATIONAL,          // polyphase filter for a rational factor
+    RESAMPLE_FRACTIONAL         // interpolated coefficients per output
+};
+
+
+/** Sample rates and decimation factors for one receiver configuration. */
+struct RatePlan
+{
+    double          sample_rate_if;         // IF sample rate of the device
+    unsigned int    downsample;             // decimation from IF to baseband
+    unsigned int    halfband_stages;        // half-band stages in downsample
+    double          sample_rate_baseband;   // sample_rate_if / downsample
+    double          sample_rate_pcm;        // audio sample rate
+    ResampleMode    resample_mode;          // audio resampling algorithm
+    unsigned int    resample_up;            // baseband / pcm rate is
+    unsigned int    resample_down;          //   resample_down / resample_up
+    bool            resample_fft;           // resampler uses FFT convolution
+    double          cost;                   // predicted load in CPU cores
+};
+
+
+/**
+ *  Planner for the sample rates of the receiver.
+ *
+ *  The planner picks the IF sample rate, the decimation to baseband and
+ *  the audio resampling algorithm for a given audio sample rate.
+ *  IF rates near the preferred rate that are an integer multiple of the
+ *  audio rate let the audio resampler decimate by an integer factor.
+ *
+ *  Costs are predicted from per-sample timings of the floating-point
+ *  decoder on a 2.1 GHz x86 core with AVX2 and scale with the sample
+ *  rates. They are meant to compare plans, not to be exact.
+ */
+class RatePlanner
+{
+public:
+
+    /**
+     * Minimum baseband sample rate to hold the FM multiplex signal.
+     *
+     * The IF filter needs some room between the +/- 100 kHz station and
+     * the baseband Nyquist frequency; below ~ 250 kS/s it starts to cut
+     * into the stereo subcarrier and stereo distortion rises.
+     */
+    static constexpr double min_baseband_rate = 250.0e3;
+
+    /** Default IF sample rate range (RTL-SDR upper range). */
+    static constexpr double default_min_if_rate = 0.9e6;
+    static constexpr double default_max_if_rate = 3.2e6;
+
+    /** Default relative deviation from the preferred IF rate. */
+    static constexpr double default_if_tolerance = 0.1;
+
+    /**
+     * Construct planner.
+     *
+     * sample_rate_pcm :: Audio sample rate in Hz
+     * stereo          :: True if stereo decoding is enabled
+     */
+    RatePlanner(double sample_rate_pcm, bool stereo);
+
+    /** Set the range of IF sample rates supported by the device. */
+    void set_if_range(double min_rate, double max_rate);
+
+    /** Set the allowed relative deviation from the preferred IF rate. */
+    void set_if_tolerance(double tolerance);
+
+    /**
+     * Return the cheapest plan for a fixed IF sample rate.
+     *
+     * Only the decimation to baseband is chosen; the audio resampler
+     * uses whatever algorithm the resulting rates allow.
+     */
+    RatePlan plan_fixed(double sample_rate_if) const;
+
+    /**
+     * Return a plan with an IF sample rate near the preferred rate.
+     *
+     * preferred_if :: Preferred IF sample rate in Hz
+     * max_cost     :: CPU budget as a fraction of one core
+     *
+     * Among the plans within budget the cheapest one wins, but integer
+     * resampling is preferred over rational and rational over fractional
+     * resampling at up to 10% higher cost. If no plan fits the budget,
+     * the cheapest plan is returned.
+     */
+    RatePlan plan(double preferred_if, double max_cost) const;
+
+    /** Return a short name for a resampling algorithm. */
+    static const char * get_mode_name(ResampleMode mode);
+
+private:
+
+    /** Fill in a plan and predict its cost. */
+    RatePlan make_plan(double sample_rate_if, unsigned int downsample) const;
+
+    /** Return the predicted cost of a plan in CPU cores. */
+    double predict_cost(const RatePlan& plan) const;
+
+    /** Return true if plan a is better than plan b. */
+    static bool is_better(const RatePlan& a, const RatePlan& b,
+                          double max_cost);
+
+    double          m_sample_rate_pcm;
+    bool            m_stereo;
+    double          m_min_if_rate;
+    double          m_max_if_rate;
+    double          m_if_tolerance;
+};
+
+#endif
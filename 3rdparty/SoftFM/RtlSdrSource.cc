@@ -39,6 +39,7 @@
 #include <cstring>
 #include <rtl-sdr.h>
 
+#include "DspKernels.h"
 #include "RtlSdrSource.h"
 
 using namespace std;
@@ -48,6 +49,7 @@ using namespace std;
 RtlSdrSource::RtlSdrSource(int dev_index)
     : m_dev(0)
     , m_block_length(default_block_length)
+    , m_iq_correction(true)
 {
     int r;
 
@@ -181,17 +183,45 @@ vector<int> RtlSdrSource::get_tuner_gains()
 }
 
 
+// Enable or disable IQ correction.
+void RtlSdrSource::set_iq_correction(bool enable)
+{
+    if (enable && !m_iq_correction)
+        m_iqcorr.reset();
+    m_iq_correction = enable;
+}
+
+
 // Fetch a bunch of samples from the device.
 bool RtlSdrSource::get_samples(IQSampleVector& samples)
+{
+    if (!get_samples_raw(m_buf))
+        return false;
+
+    // DC offset and IQ imbalance are corrected during the conversion.
+    samples.resize(m_block_length);
+    if (m_iq_correction) {
+        m_iqcorr.process(m_buf.data(), m_block_length, samples.data());
+    } else {
+        dsp_kernels().convert_cu8(m_buf.data(), m_block_length,
+                                  samples.data());
+    }
+
+    return true;
+}
+
+
+// Fetch a bunch of raw IQ data from the device.
+bool RtlSdrSource::get_samples_raw(RawSampleVector& samples)
 {
     int r, n_read;
 
     if (!m_dev)
         return false;
 
-    vector<uint8_t> buf(2 * m_block_length);
+    samples.resize(2 * m_block_length);
 
-    r = rtlsdr_read_sync(m_dev, buf.data(), 2 * m_block_length, &n_read);
+    r = rtlsdr_read_sync(m_dev, samples.data(), 2 * m_block_length, &n_read);
     if (r < 0) {
         m_error = "rtlsdr_read_sync failed";
         return false;
@@ -202,14 +232,6 @@ bool RtlSdrSource::get_samples(IQSampleVector& samples)
         return false;
     }
 
-    samples.resize(m_block_length);
-    for (int i = 0; i < m_block_length; i++) {
-        int32_t re = buf[2*i];
-        int32_t im = buf[2*i+1];
-        samples[i] = IQSample( (re - 128) / IQSample::value_type(128),
-                               (im - 128) / IQSample::value_type(128) );
-    }
-
     return true;
 }
 
@@ -43,6 +43,7 @@
 #include <vector>
 
 #include "SoftFM.h"
+#include "Filter.h"
 
 
 class RtlSdrSource
@@ -92,6 +93,21 @@ public:
         return m_devname;
     }
 
+    /**
+     * Enable or disable adaptive DC offset and IQ imbalance correction
+     * of the samples returned by get_samples(). Enabled by default.
+     *
+     * With correction enabled, the DC spike of the tuner is removed, so
+     * stations can be received at zero offset from the center frequency.
+     */
+    void set_iq_correction(bool enable);
+
+    /** Return true if IQ correction is enabled. */
+    bool get_iq_correction() const
+    {
+        return m_iq_correction;
+    }
+
     /**
      * Fetch a bunch of samples from the device.
      *
@@ -100,6 +116,14 @@ public:
      */
     bool get_samples(IQSampleVector& samples);
 
+    /**
+     * Fetch a bunch of raw IQ data from the device.
+     *
+     * Same as get_samples(), but return interleaved unsigned 8-bit I/Q
+     * values as produced by the device, without conversion.
+     */
+    bool get_samples_raw(RawSampleVector& samples);
+
     /** Return the last error, or return an empty string if there is no error. */
     std::string error()
     {
@@ -120,6 +144,9 @@ public:
 private:
     struct rtlsdr_dev * m_dev;
     int                 m_block_length;
+    bool                m_iq_correction;
+    IQCorrector         m_iqcorr;
+    RawSampleVector     m_buf;
     std::string         m_devname;
     std::string         m_error;
 };
@@ -39,31 +39,100 @@
 #define SOFTFM_H
 
 #include <complex>
+#include <cstdint>
 #include <vector>
 
 typedef std::complex<float> IQSample;
 typedef std::vector<IQSample> IQSampleVector;
 
+/**
+ * IQ samples in split layout: the I and Q components in separate arrays.
+ * SIMD kernels load either component as a plain vector, without the
+ * shuffles needed to separate interleaved IQSample values.
+ */
+struct IQSplitVector
+{
+    std::vector<IQSample::value_type> re, im;
+
+    unsigned int size() const
+    {
+        return re.size();
+    }
+
+    void resize(unsigned int n)
+    {
+        re.resize(n);
+        im.resize(n);
+    }
+};
+
+/*
+ * Real-valued samples are double precision by default.
+ * Define SOFTFM_SAMPLE_FLOAT to build the decode chain in single precision.
+ */
+#ifdef SOFTFM_SAMPLE_FLOAT
+typedef float Sample;
+#else
 typedef double Sample;
+#endif
 typedef std::vector<Sample> SampleVector;
 
+/** Raw IQ data from RTL-SDR: interleaved unsigned 8-bit I and Q values. */
+typedef std::vector<std::uint8_t> RawSampleVector;
 
-/** Compute mean and RMS over a sample vector. */
-inline void samples_mean_rms(const SampleVector& samples,
-                             double& mean, double& rms)
+/*
+ * Samples for the fixed-point decode chain.
+ * Values are Q14: (1 << fixed_frac_bits) represents 1.0.
+ */
+static constexpr int fixed_frac_bits = 14;
+
+struct IQSample16
 {
-    Sample vsum = 0;
-    Sample vsumsq = 0;
+    std::int16_t re, im;
+};
+typedef std::vector<IQSample16> IQSample16Vector;
+
+typedef std::int16_t Sample16;
+typedef std::vector<Sample16> Sample16Vector;
+
+
+/** Add the sum and the sum of squares of n samples to vsum and vsumsq. */
+inline void samples_sum_sumsq(const Sample * samples, unsigned int n,
+                              double& vsum, double& vsumsq)
+{
+    // Accumulate in double precision, even if Sample is float.
+    double sum = vsum;
+    double sumsq = vsumsq;
 
-    unsigned int n = samples.size();
     for (unsigned int i = 0; i < n; i++) {
         Sample v = samples[i];
-        vsum   += v;
-        vsumsq += v * v;
+        sum   += v;
+        sumsq += v * v;
     }
 
+    vsum = sum;
+    vsumsq = sumsq;
+}
+
+
+/** Compute mean and RMS over n samples. */
+inline void samples_mean_rms(const Sample * samples, unsigned int n,
+                             double& mean, double& rms)
+{
+    double vsum = 0;
+    double vsumsq = 0;
+    samples_sum_sumsq(samples, n, vsum, vsumsq);
+
     mean = vsum / n;
     rms  = sqrt(vsumsq / n);
 }
 
+
+/** Compute mean and RMS over a sample vector. */
+inline void samples_mean_rms(const SampleVector& samples,
+                             double& mean, double& rms)
+{
+    samples_mean_rms(samples.data(), samples.size(), mean, rms);
+}
+
 #endif
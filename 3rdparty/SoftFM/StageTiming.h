@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOFTFM_STAGETIMING_H
+#define SOFTFM_STAGETIMING_H
+
+#include <cstdint>
+#include <vector>
+
+#ifdef SOFTFM_STAGE_TIMING
+#include <time.h>
+#endif
+
+
+/** Processing stages of FmDecoder. */
+enum DecoderStage {
+    STAGE_FINETUNER,            // frequency shift of the IF signal
+    STAGE_HALFBAND,             // half-band decimation stages
+    STAGE_IF_FILTER,            // final IF filter and decimation
+    STAGE_LEVELS,               // IF and baseband level measurement
+    STAGE_DISCRIMINATOR,        // FM phase discriminator
+    STAGE_PILOT_PLL,            // stereo pilot phase lock
+    STAGE_STEREO_DEMOD,         // L-R demodulation
+    STAGE_RESAMPLER,            // audio low-pass filter and resampling
+    STAGE_AUDIO_OUTPUT,         // DC blocking, de-emphasis and encoding
+    NUM_DECODER_STAGES
+};
+
+
+/** Accumulated counters of one decoder stage. */
+struct StageStats
+{
+    const char *    name;
+    std::uint64_t   calls;
+    std::uint64_t   samples;        // input samples of the stage
+    std::uint64_t   nanoseconds;
+
+    /** Return the average time per input sample in nanoseconds. */
+    double ns_per_sample() const
+    {
+        return samples ? double(nanoseconds) / samples : 0;
+    }
+};
+
+
+/**
+ *  Per-stage time counters.
+ *
+ *  The counters are only compiled in when SOFTFM_STAGE_TIMING is defined.
+ *  Otherwise now() and add() are empty inline functions and the timing
+ *  code in the decoder compiles to nothing.
+ *
+ *  Usage, with one clock read per stage boundary:
+ *    std::uint64_t t = StageCounters::now();
+ *    ... stage A ...
+ *    t = counters.add(STAGE_A, t, n);
+ *    ... stage B ...
+ *    t = counters.add(STAGE_B, t, n);
+ */
+class StageCounters
+{
+public:
+
+#ifdef SOFTFM_STAGE_TIMING
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /** Constructor. */
+    StageCounters()
+    {
+        reset();
+    }
+
+    /** Return a monotonic time stamp in nanoseconds, or 0 if disabled. */
+    static std::uint64_t now()
+    {
+#ifdef SOFTFM_STAGE_TIMING
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return std::uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Count one call of a stage that started at time t0 and processed
+     * n input samples. Return the current time stamp.
+     */
+    std::uint64_t add(DecoderStage stage, std::uint64_t t0, unsigned int n)
+    {
+#ifdef SOFTFM_STAGE_TIMING
+        std::uint64_t t = now();
+        m_calls[stage]++;
+        m_samples[stage] += n;
+        m_nanoseconds[stage] += t - t0;
+        return t;
+#else
+        (void)stage; (void)t0; (void)n;
+        return 0;
+#endif
+    }
+
+    /** Clear all counters. */
+    void reset()
+    {
+#ifdef SOFTFM_STAGE_TIMING
+        for (unsigned int i = 0; i < NUM_DECODER_STAGES; i++) {
+            m_calls[i] = 0;
+            m_samples[i] = 0;
+            m_nanoseconds[i] = 0;
+        }
+#endif
+    }
+
+    /** Add the counters of another instance to the statistics. */
+    void merge_into(std::vector<StageStats>& stats) const
+    {
+        stats.resize(NUM_DECODER_STAGES);
+        for (unsigned int i = 0; i < NUM_DECODER_STAGES; i++) {
+            stats[i].name = stage_name(DecoderStage(i));
+#ifdef SOFTFM_STAGE_TIMING
+            stats[i].calls += m_calls[i];
+            stats[i].samples += m_samples[i];
+            stats[i].nanoseconds += m_nanoseconds[i];
+#endif
+        }
+    }
+
+    /** Return the name of a stage. */
+    static const char * stage_name(DecoderStage stage)
+    {
+        static const char * const names[NUM_DECODER_STAGES] = {
+            "finetuner", "halfband", "if_filter", "levels",
+            "discriminator", "pilot_pll", "stereo_demod", "resampler",
+            "audio_output"
+        };
+        return names[stage];
+    }
+
+private:
+#ifdef SOFTFM_STAGE_TIMING
+    std::uint64_t   m_calls[NUM_DECODER_STAGES];
+    std::uint64_t   m_samples[NUM_DECODER_STAGES];
+    std::uint64_t   m_nanoseconds[NUM_DECODER_STAGES];
+#endif
+};
+
+#endif
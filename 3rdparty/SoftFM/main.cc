@@ -491,9 +491,9 @@ int main(int argc, char **argv)
     thread source_thread(read_source_data, &rtlsdr, &source_buffer);
 
     // The baseband signal is empty above 100 kHz, so we can
-    // downsample to ~ 200 kS/s without loss of information.
+    // downsample to ~ 250 kS/s without loss of information.
     // This will speed up later processing stages.
-    unsigned int downsample = max(1, int(ifrate / 215.0e3));
+    unsigned int downsample = max(1, int(ifrate / 250.0e3));
     fprintf(stderr, "baseband downsampling factor %u\n", downsample);
 
     // Prevent aliasing at very low output sample rates.
@@ -560,11 +560,22 @@ int main(int argc, char **argv)
                     filename.c_str());
             audio_output.reset(new WavAudioOutput(filename, pcmrate, stereo));
             break;
-        case MODE_ALSA:
+        case MODE_ALSA: {
             fprintf(stderr, "playing audio to ALSA device '%s'\n",
                     alsadev.c_str());
-            audio_output.reset(new AlsaAudioOutput(alsadev, pcmrate, stereo));
+            AlsaAudioOutput * alsa_output =
+                new AlsaAudioOutput(alsadev, pcmrate, stereo);
+            audio_output.reset(alsa_output);
+            // ALSA does not resample; the device must play pcmrate.
+            if (*alsa_output &&
+                alsa_output->get_sample_rate() != (unsigned int)pcmrate) {
+                fprintf(stderr, "ERROR: ALSA device does not play %d Hz "
+                                "natively, try -r %u\n",
+                        pcmrate, alsa_output->get_sample_rate());
+                exit(1);
+            }
             break;
+        }
     }
 
     if (!(*audio_output)) {
@@ -4,3 +4,6 @@ lessThan(QT_VERSION, 5.15) {
 
 TEMPLATE = subdirs
 SUBDIRS = src
+
+# Standalone DSP test harness: qmake CONFIG+=dsptest
+dsptest: SUBDIRS += tools/dsptest
@@ -41,12 +41,12 @@
 /** Flag is set on SIGINT / SIGTERM. */
 static atomic_bool stop_flag(false);
 
-/** Simple linear gain adjustment. */
-void adjust_gain(SampleVector& samples, double gain)
+/** Return Unix time stamp in seconds. */
+double get_time()
 {
-    for (unsigned int i = 0, n = samples.size(); i < n; i++) {
-        samples[i] *= gain;
-    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
 }
 
 /**
@@ -60,23 +60,70 @@ void adjust_gain(SampleVector& samples, double gain)
 void read_source_data(RtlSdrSource *rtlsdr, DataBuffer<IQSample> *buf)
 {
     IQSampleVector iqsamples;
+    double sample_rate = rtlsdr->get_sample_rate();
+    uint64_t sample_index = 0;
     while (!stop_flag.load()) {        
         if (!rtlsdr->get_samples(iqsamples)) {
             fprintf(stderr, "ERROR: RtlSdr: %s\n", rtlsdr->error().c_str());
             exit(1);
         }
-        buf->push(move(iqsamples));
+        // The last sample of the block has just been captured.
+        size_t n = iqsamples.size();
+        BlockStamp stamp(get_time() - n / sample_rate, sample_index);
+        sample_index += n;
+        buf->push(move(iqsamples), stamp);
     }
     buf->push_end();
 }
 
+/**
+ * Read raw IQ data from source device and put it in a buffer.
+ *
+ * Same as read_source_data(), for the fixed-point decoder.
+ */
+void read_source_raw(RtlSdrSource *rtlsdr, DataBuffer<uint8_t> *buf)
+{
+    RawSampleVector rawsamples;
+    double sample_rate = rtlsdr->get_sample_rate();
+    uint64_t sample_index = 0;
+    while (!stop_flag.load()) {
+        if (!rtlsdr->get_samples_raw(rawsamples)) {
+            fprintf(stderr, "ERROR: RtlSdr: %s\n", rtlsdr->error().c_str());
+            exit(1);
+        }
+        size_t n = rawsamples.size() / 2;
+        BlockStamp stamp(get_time() - n / sample_rate, sample_index);
+        sample_index += n;
+        buf->push(move(rawsamples), stamp);
+    }
+    buf->push_end();
+}
+
+/**
+ * Record the latency of the first frame of a block that has just been
+ * written to the audio output.
+ *
+ * The frames of the block are the last ones in the device delay, so
+ * the first frame plays after (delay - frames) frames.
+ */
+static void record_latency(LatencyHistogram *hist, const BlockStamp& stamp,
+                           const AudioOutput *output, unsigned int frames,
+                           double pcm_rate)
+{
+    if (stamp.capture_time <= 0)
+        return;
+    double delay = (double(output->get_delay()) - frames) / pcm_rate;
+    hist->add(get_time() + delay - stamp.capture_time);
+}
+
 /**
  * Get data from output buffer and write to output stream.
  *
  * This code runs in a separate thread.
  */
-void write_output_data(AudioOutput *output, DataBuffer<Sample> *buf,
-                       unsigned int buf_minfill)
+void write_output_data(AudioOutput *output, DataBuffer<uint8_t> *buf,
+                       unsigned int buf_minfill, unsigned int nchannel,
+                       double pcm_rate, LatencyHistogram *hist)
 {
     while (!stop_flag.load()) {
 
@@ -94,21 +141,32 @@ void write_output_data(AudioOutput *output, DataBuffer<Sample> *buf,
         }
 
         // Get samples from buffer and write to output.
-        SampleVector samples = buf->pull();
-        //fprintf(stderr, "\n SampleVector: %u \n", samples.size());
-        output->write(samples);
+        BlockStamp stamp;
+        vector<uint8_t> pcm = buf->pull(&stamp);
+        output->write_s16le(pcm.data(), pcm.size() / 2);
+        record_latency(hist, stamp, output, pcm.size() / 2 / nchannel,
+                       pcm_rate);
         if (!(*output)) {
             fprintf(stderr, "ERROR: AudioOutput: %s\n", output->error().c_str());
         }
     }
 }
 
-/** Return Unix time stamp in seconds. */
-double get_time()
-{
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+// IF sample rates supported by the receiver.
+static const double supported_ifrates[] = { 1.0e6, 2.048e6, 2.4e6, 3.2e6 };
+
+// Highest IF sample rate at which RTL-SDR devices run without dropping
+// samples. Higher rates are only used when chosen as preferred rate.
+static const double max_dependable_ifrate = 2.4e6;
+
+// Return the supported IF sample rate closest to r.
+static double nearest_ifrate(double r) {
+    double best = supported_ifrates[0];
+    for (double s : supported_ifrates) {
+        if (fabs(s - r) < fabs(best - r))
+            best = s;
+    }
+    return best;
 }
 
 Receiver::Receiver(QObject* p) : QObject(p) {
@@ -116,12 +174,43 @@ Receiver::Receiver(QObject* p) : QObject(p) {
     freq = mApp->value("freq", 10000000).toDouble();
     agcmode = mApp->value("agc", true).toBool();
     stereo = mApp->value("stereo", true).toBool();
+    fixedpoint = mApp->value("fixedpoint", false).toBool();
+    zerooffset = mApp->value("zerooffset", false).toBool();
+    ifrate = nearest_ifrate(mApp->value("ifrate", 1.0e6).toDouble());
+    setIfTolerance(mApp->value("iftolerance",
+                               RatePlanner::default_if_tolerance).toDouble());
+    cpubudget = mApp->value("cpubudget", 0.5).toDouble();
+    lowlatency = mApp->value("lowlatency", false).toBool();
+    setLatency(mApp->value("latency", 0.05).toDouble());
+    striplength = mApp->value("striplength", FmDecoder::default_strip_length).toUInt();
 }
 
 Receiver::~Receiver(){
-    mApp->setValue("freq", (int)tuner_freq);
+    mApp->setValue("freq", (int)(tuner_freq + if_offset));
     mApp->setValue("agc", agcmode);
     mApp->setValue("stereo", stereo);
+    mApp->setValue("fixedpoint", fixedpoint);
+    mApp->setValue("zerooffset", zerooffset);
+    mApp->setValue("ifrate", nearest_ifrate(ifrate));
+    mApp->setValue("iftolerance", iftolerance);
+    mApp->setValue("cpubudget", cpubudget);
+    mApp->setValue("lowlatency", lowlatency);
+    mApp->setValue("latency", latency);
+    mApp->setValue("striplength", striplength);
+}
+
+void Receiver::setIfRate(double r){
+    ifrate = nearest_ifrate(r);
+}
+
+void Receiver::setIfTolerance(double t){
+    // Beyond +/- 50% the rate would no longer resemble the preferred rate.
+    iftolerance = min(0.5, max(0.0, t));
+}
+
+void Receiver::setLatency(double secs){
+    // Below ~10 ms the ALSA periods get too short to play without underruns.
+    latency = max(0.01, secs);
 }
 
 void Receiver::init(){
@@ -140,86 +229,191 @@ void Receiver::start() {
         return;
     }
 
+    // In low-latency mode, split the latency target between the buffers:
+    // two fifths for the ALSA buffer, one fifth each for the source block
+    // and the jitter buffer, the rest for decoding and scheduling.
+    unsigned int alsa_latency = AlsaAudioOutput::default_latency;
+    if (lowlatency)
+        alsa_latency = lrint(0.4e6 * latency);
+
+    // Open the audio device first. The decoder produces the native rate
+    // of the device, so ALSA does not resample a second time.
+    unique_ptr<AudioOutput> audio_output;
+    unsigned int pcm_rate = pcmrate;
+    switch (outmode) {
+        case MODE_ALSA: {
+            AlsaAudioOutput * alsa_output =
+                new AlsaAudioOutput(alsadev, pcmrate, stereo, alsa_latency);
+            audio_output.reset(alsa_output);
+            pcm_rate = alsa_output->get_sample_rate();
+            break;
+        }
+    }
+
+    if (!(*audio_output)) {
+        fprintf(stderr, "ERROR: AudioOutput: %s\n", audio_output->error().c_str());
+        return;
+    }
+
+    // Plan the sample rates. An IF rate near the preferred rate that is
+    // a multiple of the audio rate lets the audio resampler decimate by
+    // an integer factor. The planner stays below the dependable device
+    // rate unless a higher rate was chosen.
+    RatePlanner planner(pcm_rate, stereo);
+    planner.set_if_range(RatePlanner::default_min_if_rate,
+                         max(ifrate, max_dependable_ifrate));
+    planner.set_if_tolerance(iftolerance);
+    RatePlan plan = planner.plan(ifrate, cpubudget);
+    double if_rate = plan.sample_rate_if;
+    if (if_rate != ifrate)
+        fprintf(stderr, "IF rate %.0f Hz moved to %.0f Hz by rate planner\n",
+                ifrate, if_rate);
+
+    // The device rounds the block length to a multiple of 4096 samples.
+    int block_length = RtlSdrSource::default_block_length;
+    if (lowlatency)
+        block_length = max(4096, int(0.2 * latency * if_rate));
+
     // Intentionally tune at a higher frequency to avoid DC offset.
-    tuner_freq = freq; // + 0.25 * ifrate;
+    // The floating-point source removes the DC offset during conversion,
+    // so with zero-offset tuning the station stays at the center.
+    bool offset_tuning = fixedpoint || !zerooffset;
+    tuner_freq = offset_tuning ? freq + 0.25 * if_rate : freq;
     rtlsdr.reset(new RtlSdrSource(devidx));
 
     // Configure RTL-SDR device and start streaming.
-    rtlsdr->configure(ifrate, tuner_freq, lnagain, RtlSdrSource::default_block_length, agcmode);
+    rtlsdr->configure(if_rate, tuner_freq, lnagain, block_length, agcmode);
     if (!rtlsdr) {
         fprintf(stderr, "ERROR: RtlSdr: %s\n", rtlsdr->error().c_str());
         return;
     }
-    int f = rtlsdr->get_frequency();
-    tuner_freq = f;
-    emit newFreq(f);
-
-    ifrate = rtlsdr->get_sample_rate();
+    tuner_freq = rtlsdr->get_frequency();
+
+    // Offset of the station with respect to the LO, removed by the decoder.
+    if_offset = freq - tuner_freq;
+    emit newFreq(getFreq());
+
+    // The device rate deviates from the requested rate by a few ppm at
+    // most. Keep the nominal rate so the planned factors stay exact,
+    // unless the device settled on a different rate.
+    double device_rate = rtlsdr->get_sample_rate();
+    if (fabs(device_rate - if_rate) > 1.0e-4 * if_rate) {
+        plan = planner.plan_fixed(device_rate);
+        if_rate = device_rate;
+    }
+    fprintf(stderr, "IF %.0f Hz / %u (%u half-band) = %.0f Hz, "
+                    "%s resampling to %.0f Hz, predicted load %.1f%%\n",
+            plan.sample_rate_if, plan.downsample, plan.halfband_stages,
+            plan.sample_rate_baseband,
+            RatePlanner::get_mode_name(plan.resample_mode),
+            plan.sample_rate_pcm, 100 * plan.cost);
 
     // Create source data queue.
+    // The fixed-point decoder takes raw IQ data from the device.
     DataBuffer<IQSample> source_buffer;
+    DataBuffer<uint8_t> raw_buffer;
 
     // Start reading from device in separate thread.
-    std::thread source_thread(read_source_data, rtlsdr.get(), &source_buffer);
+    std::thread source_thread;
+    if (fixedpoint) {
+        source_thread = std::thread(read_source_raw, rtlsdr.get(), &raw_buffer);
+    } else {
+        source_thread = std::thread(read_source_data, rtlsdr.get(), &source_buffer);
+    }
 
-    // The baseband signal is empty above 100 kHz, so we can
-    // downsample to ~ 200 kS/s without loss of information.
-    // This will speed up later processing stages.
-    unsigned int downsample = max(1, int(ifrate / 215.0e3));
+    // The planner decimates to ~ 250 kS/s before demodulation.
+    unsigned int downsample = plan.downsample;
 
     // Prevent aliasing at very low output sample rates.
-    double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmrate);
-
-    // Prepare decoder.
-    FmDecoder fm(ifrate,                            // sample_rate_if
-                 freq - tuner_freq,                 // tuning_offset
-                 pcmrate,                           // sample_rate_pcm
+    double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm, 0.45 * pcm_rate);
+
+    // Prepare floating-point or fixed-point decoder.
+    unique_ptr<FmDecoder> fm;
+    unique_ptr<FmDecoderFixed> fmfixed;
+    if (fixedpoint) {
+        fmfixed.reset(new FmDecoderFixed(
+                 if_rate,                           // sample_rate_if
+                 if_offset,                         // tuning_offset
+                 pcm_rate,                          // sample_rate_pcm
+                 stereo,                            // stereo
+                 FmDecoder::default_deemphasis,     // deemphasis,
+                 FmDecoder::default_bandwidth_if,   // bandwidth_if
+                 FmDecoder::default_freq_dev,       // freq_dev
+                 bandwidth_pcm,                     // bandwidth_pcm
+                 downsample));                      // downsample
+    } else {
+        fm.reset(new FmDecoder(
+                 if_rate,                           // sample_rate_if
+                 if_offset,                         // tuning_offset
+                 pcm_rate,                          // sample_rate_pcm
                  stereo,                            // stereo
                  FmDecoder::default_deemphasis,     // deemphasis,
                  FmDecoder::default_bandwidth_if,   // bandwidth_if
                  FmDecoder::default_freq_dev,       // freq_dev
                  bandwidth_pcm,                     // bandwidth_pcm
-                 downsample);                       // downsample
+                 downsample,                        // downsample
+                 block_length));                    // block_length
+
+        // Decode each block in cache-sized strips.
+        fm->set_strip_length(striplength);
+    }
+
+    // Set nominal audio volume.
+    // The decoder applies it while encoding the output samples.
+    if (fixedpoint) {
+        fmfixed->set_audio_gain(0.5);
+    } else {
+        fm->set_audio_gain(0.5);
+    }
 
     // Calculate number of samples in audio buffer.
     unsigned int outputbuf_samples = 0;
-    if (bufsecs < 0 && (outmode == MODE_ALSA)) {
+    if (lowlatency) {
+        // Jitter buffer of one fifth of the latency target.
+        outputbuf_samples = max(1u, (unsigned int)(0.2 * latency * pcm_rate));
+    } else if (bufsecs < 0 && (outmode == MODE_ALSA)) {
         // Set default buffer to 1 second for interactive output streams.
-        outputbuf_samples = pcmrate;
+        outputbuf_samples = pcm_rate;
     } else if (bufsecs > 0) {
         // Calculate nr of samples for configured buffer length.
-        outputbuf_samples = (unsigned int)(bufsecs * pcmrate);
+        outputbuf_samples = (unsigned int)(bufsecs * pcm_rate);
     }
     if (outputbuf_samples > 0) {
-        //fprintf(stderr, "output buffer:     %.1f seconds\n", outputbuf_samples / double(pcmrate));
-    }
-
-    // Prepare output writer.
-    unique_ptr<AudioOutput> audio_output;
-    switch (outmode) {
-        case MODE_ALSA:
-            audio_output.reset(new AlsaAudioOutput(alsadev, pcmrate, stereo));
-            break;
+        //fprintf(stderr, "output buffer:     %.1f seconds\n", outputbuf_samples / double(pcm_rate));
     }
-
-    if (!(*audio_output)) {
-        fprintf(stderr, "ERROR: AudioOutput: %s\n", audio_output->error().c_str());
-        return;
+    if (lowlatency) {
+        fprintf(stderr, "latency target %.0f ms: block %.1f ms, "
+                        "ALSA buffer %.1f ms, jitter buffer %.1f ms\n",
+                1.0e3 * latency,
+                1.0e3 * (block_length - block_length % 4096) / if_rate,
+                1.0e-3 * alsa_latency,
+                1.0e3 * outputbuf_samples / pcm_rate);
     }
 
     // If buffering enabled, start background output thread.
-    DataBuffer<Sample> output_buffer;
+    // The buffer holds signed 16-bit little-endian audio data.
+    DataBuffer<uint8_t> output_buffer;
     std::thread output_thread;
     if (outputbuf_samples > 0) {
         unsigned int nchannel = stereo ? 2 : 1;
         output_thread = std::thread(write_output_data,
                                audio_output.get(),
                                &output_buffer,
-                               outputbuf_samples * nchannel);
+                               2 * outputbuf_samples * nchannel,
+                               nchannel,
+                               double(pcm_rate),
+                               &latency_hist);
     }
 
-    SampleVector audiosamples;
+    vector<uint8_t> audiopcm;
     bool inbuf_length_warning = false;
+    bool latency_warning = false;
+    uint64_t audio_index = 0;
+    latency_hist.clear();
+
+    // The audio reflects the IF signal delayed by the decoder filters.
+    double decoder_delay = fixedpoint ? fmfixed->get_delay()
+                                      : fm->get_delay();
     double audio_level = 0;
     bool got_stereo = false;
     double block_time = get_time();
@@ -227,30 +421,44 @@ void Receiver::start() {
     // Main loop.
     for (unsigned int block = 0; !stop_flag.load(); block++) {
         // Check for overflow of source buffer.
-        if (!inbuf_length_warning &&
-            source_buffer.queued_samples() > 10 * ifrate) {
+        size_t inbuf_samples = fixedpoint ? raw_buffer.queued_samples() / 2
+                                          : source_buffer.queued_samples();
+        if (!inbuf_length_warning && inbuf_samples > 10 * if_rate) {
             inbuf_length_warning = true;
         }
 
-        // Pull next block from source buffer.
-        IQSampleVector iqsamples = source_buffer.pull();
-        if (iqsamples.empty())
-            break;
+        // Pull next block from source buffer and decode FM signal.
+        // The decoder measures the audio level and applies the gain
+        // in the same pass that encodes the output samples.
+        bool stereo_detected;
+        double audio_rms;
+        BlockStamp stamp;
+        if (fixedpoint) {
+            RawSampleVector rawsamples = raw_buffer.pull(&stamp);
+            if (rawsamples.empty())
+                break;
+            fmfixed->process_s16le(rawsamples, audiopcm);
+            stereo_detected = fmfixed->stereo_detected();
+            audio_rms = fmfixed->get_audio_level();
+        } else {
+            IQSampleVector iqsamples = source_buffer.pull(&stamp);
+            if (iqsamples.empty())
+                break;
+            unsigned int n = fm->get_max_output_size(iqsamples.size());
+            audiopcm.resize(2 * n);
+            n = fm->process_s16le(iqsamples.data(), iqsamples.size(),
+                                  audiopcm.data());
+            audiopcm.resize(2 * n);
+            stereo_detected = fm->stereo_detected();
+            audio_rms = fm->get_audio_level();
+        }
 
         double prev_block_time = block_time;
         block_time = get_time();
 
-        // Decode FM signal.
-        fm.process(iqsamples, audiosamples);
-
-        // Measure audio level.
-        double audio_mean, audio_rms;
-        samples_mean_rms(audiosamples, audio_mean, audio_rms);
+        // Smooth audio level.
         audio_level = 0.95 * audio_level + 0.05 * audio_rms;
 
-        // Set nominal audio volume.
-        adjust_gain(audiosamples, 0.5);
-
         // Show statistics.
 //        fprintf(stderr,
 //                "\rblk=%6d  freq=%8.4fMHz  IF=%+5.1fdB  BB=%+5.1fdB  audio=%+5.1fdB ",
@@ -261,14 +469,14 @@ void Receiver::start() {
 //                20*log10(audio_level) + 3.01);
         if (outputbuf_samples > 0) {
             unsigned int nchannel = stereo ? 2 : 1;
-            size_t buflen = output_buffer.queued_samples();
-            //fprintf(stderr, " buf=%.1fs ", buflen / nchannel / double(pcmrate));
+            size_t buflen = output_buffer.queued_samples() / 2;
+            //fprintf(stderr, " buf=%.1fs ", buflen / nchannel / double(pcm_rate));
         }
         fflush(stderr);
 
         // Show stereo status.
-        if (fm.stereo_detected() != got_stereo) {
-            got_stereo = fm.stereo_detected();
+        if (stereo_detected != got_stereo) {
+            got_stereo = stereo_detected;
             if (got_stereo){
                 emit newStereo(true);
             }else{
@@ -280,13 +488,33 @@ void Receiver::start() {
         // are still starting up.
         if (block > 0) {
 
+            // Stamp the audio with the capture time of the IF signal
+            // that it reflects.
+            unsigned int nchannel = stereo ? 2 : 1;
+            unsigned int frames = audiopcm.size() / 2 / nchannel;
+            BlockStamp audio_stamp(stamp.capture_time - decoder_delay,
+                                   audio_index);
+            audio_index += frames;
+
             // Write samples to output.
             if (outputbuf_samples > 0) {
                 // Buffered write.
-                output_buffer.push(move(audiosamples));
+                output_buffer.push(move(audiopcm), audio_stamp);
             } else {
                 // Direct write.
-                audio_output->write(audiosamples);
+                audio_output->write_s16le(audiopcm.data(),
+                                          audiopcm.size() / 2);
+                record_latency(&latency_hist, audio_stamp, audio_output.get(),
+                               frames, pcm_rate);
+            }
+
+            if (lowlatency && !latency_warning && block > 10) {
+                LatencyStats stats = latency_hist.get_stats();
+                if (stats.count > 0 && stats.last > latency) {
+                    fprintf(stderr, "WARNING: latency %.1f ms exceeds target %.1f ms\n",
+                            1.0e3 * stats.last, 1.0e3 * latency);
+                    latency_warning = true;
+                }
             }
         }
     }
@@ -297,9 +525,29 @@ void Receiver::start() {
         output_buffer.push_end();
         output_thread.join();
     }
+
+    LatencyStats stats = latency_hist.get_stats();
+    if (stats.count > 0) {
+        fprintf(stderr, "latency over %lu blocks: p50 %.1f ms, p99 %.1f ms, "
+                        "max %.1f ms\n", stats.count, 1.0e3 * stats.p50,
+                1.0e3 * stats.p99, 1.0e3 * stats.max);
+    }
+
+    // Stage timing is only counted when built with SOFTFM_STAGE_TIMING.
+    if (StageCounters::enabled && (fm || fmfixed)) {
+        vector<StageStats> stage_stats = fmfixed ? fmfixed->get_stage_stats()
+                                                 : fm->get_stage_stats();
+        for (const StageStats& st : stage_stats) {
+            if (st.calls == 0)
+                continue;
+            fprintf(stderr, "stage %-14s %10llu samples %8.2f ns/sample\n",
+                    st.name, (unsigned long long)st.samples,
+                    st.ns_per_sample());
+        }
+    }
 }
 
 void Receiver::stop(){
     stop_flag.store(true);
-    mApp->setValue("freq", (int)tuner_freq);
+    mApp->setValue("freq", (int)(tuner_freq + if_offset));
 }
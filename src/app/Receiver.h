@@ -20,6 +20,7 @@
 #ifndef RECEIVER_H
 #define RECEIVER_H
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstdio>
 #include <climits>
@@ -40,12 +41,25 @@
 #include "SoftFM.h"
 #include "RtlSdrSource.h"
 #include "FmDecode.h"
+#include "RatePlanner.h"
 #include "AudioOutput.h"
 
 #include <QtCore>
 
 using namespace std;
 
+/** Capture time and stream position of the first sample of a block. */
+struct BlockStamp
+{
+    BlockStamp(double t = 0, uint64_t index = 0)
+        : capture_time(t)
+        , sample_index(index)
+    { }
+
+    double      capture_time;   // Unix time in seconds, or 0 if unknown
+    uint64_t    sample_index;   // index of the first sample in the stream
+};
+
 /** Buffer to move sample data between threads. */
 template <class Element>
 class DataBuffer
@@ -58,12 +72,13 @@ public:
     { }
 
     /** Add samples to the queue. */
-    void push(vector<Element>&& samples)
+    void push(vector<Element>&& samples, const BlockStamp& stamp = BlockStamp())
     {
         if (!samples.empty()) {
             unique_lock<mutex> lock(m_mutex);
             m_qlen += samples.size();
             m_queue.push(move(samples));
+            m_stamps.push(stamp);
             lock.unlock();
             m_cond.notify_all();
         }
@@ -90,8 +105,9 @@ public:
      * return the samples. If the end marker has been reached, return
      * an empty vector. If the queue is empty, wait until more data is pushed
      * or until the end marker is pushed.
+     * If stamp is not NULL, it receives the stamp of the block.
      */
-    vector<Element> pull()
+    vector<Element> pull(BlockStamp * stamp = NULL)
     {
         vector<Element> ret;
         unique_lock<mutex> lock(m_mutex);
@@ -101,6 +117,9 @@ public:
             m_qlen -= m_queue.front().size();
             swap(ret, m_queue.front());
             m_queue.pop();
+            if (stamp != NULL)
+                *stamp = m_stamps.front();
+            m_stamps.pop();
         }
         return ret;
     }
@@ -124,10 +143,97 @@ private:
     size_t              m_qlen;
     bool                m_end_marked;
     queue<vector<Element>> m_queue;
+    queue<BlockStamp>   m_stamps;
     mutex               m_mutex;
     condition_variable  m_cond;
 };
 
+/** Summary of measured end-to-end latencies in seconds. */
+struct LatencyStats
+{
+    unsigned long   count;
+    double          last;
+    double          p50;
+    double          p99;
+    double          max;
+};
+
+/** Histogram of end-to-end latencies, shared between threads. */
+class LatencyHistogram
+{
+public:
+    /** Width of a histogram bin in seconds. */
+    static constexpr double bin_width = 0.0005;
+
+    /** Number of bins; longer latencies count in the last bin. */
+    static constexpr unsigned int num_bins = 4000;
+
+    /** Constructor. */
+    LatencyHistogram()
+        : m_bins(num_bins)
+    {
+        clear();
+    }
+
+    /** Remove all measurements. */
+    void clear()
+    {
+        unique_lock<mutex> lock(m_mutex);
+        fill(m_bins.begin(), m_bins.end(), 0);
+        m_count = 0;
+        m_last = 0;
+        m_max = 0;
+    }
+
+    /** Add one measurement. */
+    void add(double latency)
+    {
+        unsigned int bin = min(double(num_bins - 1),
+                               max(0.0, latency / bin_width));
+        unique_lock<mutex> lock(m_mutex);
+        m_bins[bin]++;
+        m_count++;
+        m_last = latency;
+        m_max = (m_count == 1) ? latency : max(m_max, latency);
+    }
+
+    /**
+     * Return count, last value, median, 99th percentile and maximum.
+     * Percentiles are rounded up to the bin width.
+     */
+    LatencyStats get_stats()
+    {
+        unique_lock<mutex> lock(m_mutex);
+        LatencyStats stats;
+        stats.count = m_count;
+        stats.last = m_last;
+        stats.p50 = percentile(0.50);
+        stats.p99 = percentile(0.99);
+        stats.max = m_max;
+        return stats;
+    }
+
+private:
+    /** Return the upper edge of the bin that holds fraction p. */
+    double percentile(double p) const
+    {
+        unsigned long rank = (unsigned long)ceil(p * m_count);
+        unsigned long sum = 0;
+        for (unsigned int i = 0; i < num_bins; i++) {
+            sum += m_bins[i];
+            if (sum >= rank && sum > 0)
+                return (i + 1) * bin_width;
+        }
+        return 0;
+    }
+
+    vector<unsigned long> m_bins;
+    unsigned long       m_count;
+    double              m_last;
+    double              m_max;
+    mutex               m_mutex;
+};
+
 class Receiver: public QObject {
     Q_OBJECT
 
@@ -149,26 +255,57 @@ public slots:
     void device(int i){devidx = i;};
     void agc(bool b){agcmode = b;};
     void setStereo(bool b){stereo = b;};
+    void setFixedPoint(bool b){fixedpoint = b;};
+    void setZeroOffset(bool b){zerooffset = b;};
+    // Set the preferred IF sample rate. The rate planner may pick a
+    // nearby rate that lets the audio resampler decimate by an integer
+    // factor.
+    void setIfRate(double r);
+    // Set how far, relative to the preferred IF rate, the rate planner
+    // may move the IF rate. Zero keeps the preferred rate.
+    void setIfTolerance(double t);
+    void setCpuBudget(double b){cpubudget = b;};
+    void setLowLatency(bool b){lowlatency = b;};
+    void setLatency(double secs);
+    void setStripLength(unsigned int n){striplength = n;};
     bool agc(){return agcmode;};
     bool getStereo(){ return stereo;};
-    int getFreq(){ if(!rtlsdr) return 0; return rtlsdr->get_frequency(); };
+    bool getFixedPoint(){ return fixedpoint;};
+    bool getZeroOffset(){ return zerooffset;};
+    double getIfRate(){ return ifrate;};
+    double getIfTolerance(){ return iftolerance;};
+    double getCpuBudget(){ return cpubudget;};
+    bool getLowLatency(){ return lowlatency;};
+    double getLatency(){ return latency;};
+    unsigned int getStripLength(){ return striplength;};
+    LatencyStats getLatencyStats(){ return latency_hist.get_stats();};
+    void resetLatencyStats(){ latency_hist.clear();};
+    int getFreq(){ if(!rtlsdr) return 0; return lrint(rtlsdr->get_frequency() + if_offset); };
     void setFreq(int d){
         if(!rtlsdr) return;
-        rtlsdr->set_frequency(d);
-        int f = rtlsdr->get_frequency();
-        tuner_freq = f ;
-        emit newFreq(f);
+        rtlsdr->set_frequency(lrint(d - if_offset));
+        tuner_freq = rtlsdr->get_frequency();
+        emit newFreq(getFreq());
     };
 
 private:
     double tuner_freq;
+    double  if_offset = 0;
     double  freq    = -1;
     int     devidx  = -1;
     int     lnagain = INT_MIN;
     bool    agcmode = false;
-    double  ifrate  = 1.0e6;
+    double  ifrate  = 1.0e6;    // preferred IF rate, see RatePlanner
+    double  iftolerance = RatePlanner::default_if_tolerance;
+    double  cpubudget = 0.5;
+    bool    lowlatency = false;
+    double  latency = 0.05;
+    unsigned int striplength = FmDecoder::default_strip_length;
+    LatencyHistogram latency_hist;
     int     pcmrate = 44100;
     bool    stereo  = true;
+    bool    fixedpoint = false;
+    bool    zerooffset = false;
     enum OutputMode {MODE_ALSA };
     OutputMode outmode = MODE_ALSA;
     string  filename;
@@ -11,10 +11,18 @@ QT += widgets
 CONFIG += c++11 thread release
 LIBS += -lrtlsdr -lusb-1.0 -lasound
 
-HEADERS += ../3rdparty/SoftFM/AudioOutput.h ../3rdparty/SoftFM/Filter.h \
-../3rdparty/SoftFM/FmDecode.h ../3rdparty/SoftFM/RtlSdrSource.h ../3rdparty/SoftFM/SoftFM.h
-SOURCES += ../3rdparty/SoftFM/AudioOutput.cc ../3rdparty/SoftFM/Filter.cc \
-../3rdparty/SoftFM/FmDecode.cc ../3rdparty/SoftFM/RtlSdrSource.cc
+# Single-precision decode chain: qmake CONFIG+=sample_float
+sample_float: DEFINES += SOFTFM_SAMPLE_FLOAT
+# Per-stage decoder timing: qmake CONFIG+=stage_timing
+stage_timing: DEFINES += SOFTFM_STAGE_TIMING
+
+HEADERS += ../3rdparty/SoftFM/Arena.h ../3rdparty/SoftFM/AudioOutput.h ../3rdparty/SoftFM/DspKernels.h ../3rdparty/SoftFM/Fft.h \
+../3rdparty/SoftFM/Filter.h \
+../3rdparty/SoftFM/FmDecode.h ../3rdparty/SoftFM/RatePlanner.h ../3rdparty/SoftFM/RtlSdrSource.h ../3rdparty/SoftFM/SoftFM.h \
+../3rdparty/SoftFM/StageTiming.h
+SOURCES += ../3rdparty/SoftFM/Arena.cc ../3rdparty/SoftFM/AudioOutput.cc ../3rdparty/SoftFM/DspKernels.cc ../3rdparty/SoftFM/Fft.cc \
+../3rdparty/SoftFM/Filter.cc \
+../3rdparty/SoftFM/FmDecode.cc ../3rdparty/SoftFM/RatePlanner.cc ../3rdparty/SoftFM/RtlSdrSource.cc
 
 HEADERS += \
         app/DualwordApp.h \
@@ -0,0 +1,620 @@
+/*
+ * Copyright (C) 2025 Alexander Busorgin
+ * This file is part of Binaural-SDR (https://github.com/dualword/binaural-sdr)
+ * License: GPL-3 (GPL-3.0-only)
+ *
+ * Binaural-SDR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Binaural-SDR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Binaural-SDR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Standalone test harness for the SoftFM decode chain.
+ *
+ * The harness synthesizes an FM broadcast signal carrying a 1 kHz test tone,
+ * decodes it and measures the audio output. It needs no radio hardware,
+ * so both builds of the decode chain (double and CONFIG+=sample_float)
+ * can be compared on the same input. Quality tests check the results
+ * against fixed limits and the harness exits with status 1 on failure.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "SoftFM.h"
+#include "DspKernels.h"
+#include "Fft.h"
+#include "FmDecode.h"
+#include "RatePlanner.h"
+
+using namespace std;
+
+
+/** Parameters of the synthetic signal and the decoder. */
+struct TestConfig
+{
+    double          ifrate;
+    double          pcmrate;
+    unsigned int    downsample;
+    double          seconds;
+};
+
+/** Audio quality of one channel with a test tone. */
+struct ToneQuality
+{
+    double  level;          // amplitude of the fundamental
+    double  snr;            // fundamental to noise in dB, harmonics excluded
+    double  thd;            // harmonics to fundamental in dB
+};
+
+
+/** Limits on the tone quality of one test signal, in dB. */
+struct QualityLimit
+{
+    double  min_snr;            // double build
+    double  min_snr_float;      // CONFIG+=sample_float build
+    double  max_thd;
+    double  min_separation;
+    double  max_separation;
+};
+
+
+/**
+ * Quality limits of the floating-point decoder, a few dB below the worst
+ * result at the receiver IF rates. Float samples limit the SNR to about
+ * 78 dB, and to about 75 dB for mono, where both channels carry the tone.
+ */
+static const QualityLimit stereo_limit   = { 85, 74, -65,  30, HUGE_VAL };
+static const QualityLimit mono_limit     = { 90, 72, -90,  -1, 1 };
+static const QualityLimit adjacent_limit = { 50, 50, -60,  30, HUGE_VAL };
+
+/**
+ * Quality limits of both decoders on 8-bit IQ input. Quantization adds
+ * some distortion. The fixed-point decoder has a higher noise floor; its
+ * stereo SNR is expected 6 to 15 dB below the floating-point decoder.
+ */
+static const QualityLimit cu8_stereo_limit   = { 85, 74, -60,  30, HUGE_VAL };
+static const QualityLimit cu8_mono_limit     = { 90, 72, -85,  -1, 1 };
+static const QualityLimit fixed_stereo_limit = { 74, 72, -60,  30, HUGE_VAL };
+static const QualityLimit fixed_mono_limit   = { 88, 72, -85,  -1, 1 };
+
+/** Frequency of the test tone in Hz. */
+static const double tone_freq = 1000;
+
+/** Offset and tone frequency of the adjacent channel in Hz. */
+static const double adjacent_offset = 200000;
+static const double adjacent_tone_freq = 2700;
+
+/** Number of harmonics of the test tone within the audio bandwidth. */
+static const unsigned int num_harmonics = 15;
+
+/** Number of IQ samples per block passed to the decoder. */
+static const unsigned int block_length = 65536;
+
+/**
+ * Seconds of audio skipped while the filters and the pilot PLL settle.
+ * The pilot locks after about 0.5 seconds. With strips, the block in which
+ * it locks is partly decoded as mono.
+ */
+static const double settle_time = 1.0;
+
+/** IF sample rates offered by the receiver. */
+static const double receiver_ifrates[] = { 1.0e6, 2.048e6, 2.4e6, 3.2e6 };
+
+/** Number of timing runs per FFT size; the fastest run is reported. */
+static const unsigned int fft_runs = 10;
+
+/** Number of timing runs per strip length; the fastest run is reported. */
+static const unsigned int strip_runs = 3;
+
+
+/** Print usage. */
+static void usage()
+{
+    fprintf(stderr,
+    "Usage: dsptest [options] [test ...]\n"
+            "\n"
+            "Exits with status 1 if a quality test is below its limits.\n"
+            "  -s ifrate     IF sample rate in Hz (default 1000000)\n"
+            "  -r pcmrate    Audio sample rate in Hz (default 44100)\n"
+            "  -D factor     IF decimation factor (default from RatePlanner)\n"
+            "  -t seconds    Length of the test signal (default 3)\n"
+            "\n"
+            "Tests:\n"
+            "  quality       Tone SNR, THD and stereo separation (default)\n"
+            "  rates         Stereo quality at each receiver IF rate\n"
+            "  fixed         Fixed-point against floating-point decoder on\n"
+            "                the same 8-bit IQ input\n"
+            "  fft           FFT throughput per transform size\n"
+            "  strip         Decoding time per strip length\n"
+            "\n");
+}
+
+
+/**
+ * Synthesize n IQ samples of an FM broadcast signal at an offset of
+ * -ifrate/4. The left channel carries the test tone; the right channel
+ * is silent. Without pilot, the multiplex signal is mono.
+ *
+ * If adjacent is non-zero, add a mono FM signal 200 kHz above the wanted
+ * one with a 2.7 kHz tone, at (adjacent) times the wanted amplitude.
+ */
+static IQSampleVector make_signal(const TestConfig& cfg, bool pilot,
+                                  double adjacent = 0)
+{
+    unsigned int n = lrint(cfg.seconds * cfg.ifrate);
+    IQSampleVector iq(n);
+
+    double offset = -0.25 * cfg.ifrate;
+    double freq_dev = FmDecoder::default_freq_dev;
+    double phase = 0;
+    double adj_phase = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        double t = i / cfg.ifrate;
+        double left = sin(2 * M_PI * tone_freq * t);
+        double mpx;
+        if (pilot) {
+            double p = 2 * M_PI * FmDecoder::pilot_freq * t;
+            mpx = 0.45 * left + 0.45 * left * sin(2 * p) + 0.1 * sin(p);
+        } else {
+            mpx = 0.9 * left;
+        }
+        iq[i] = IQSample(0.5 * cos(phase), 0.5 * sin(phase));
+        phase += 2 * M_PI * (offset + freq_dev * mpx) / cfg.ifrate;
+        phase = remainder(phase, 2 * M_PI);
+
+        if (adjacent != 0) {
+            double a = 0.5 * adjacent;
+            iq[i] += IQSample(a * cos(adj_phase), a * sin(adj_phase));
+            double adj_mpx = 0.9 * sin(2 * M_PI * adjacent_tone_freq * t);
+            adj_phase += 2 * M_PI * (offset + adjacent_offset
+                                     + freq_dev * adj_mpx) / cfg.ifrate;
+            adj_phase = remainder(adj_phase, 2 * M_PI);
+        }
+    }
+
+    return iq;
+}
+
+
+/**
+ * Fit DC and the test tone with its harmonics to channel ch of
+ * interleaved audio by least squares, and return the tone quality.
+ */
+static ToneQuality measure_tone(const SampleVector& audio, unsigned int ch,
+                                unsigned int nchannel, double pcmrate)
+{
+    const unsigned int m = 1 + 2 * num_harmonics;
+    unsigned int skip = lrint(settle_time * pcmrate);
+    unsigned int n = audio.size() / nchannel;
+
+    // Accumulate the normal equations of the fit.
+    vector<double> a(m * m, 0), b(m, 0), x(m);
+    for (unsigned int i = skip; i < n; i++) {
+        double y = audio[i * nchannel + ch];
+        x[0] = 1;
+        for (unsigned int h = 1; h <= num_harmonics; h++) {
+            double p = 2 * M_PI * h * tone_freq * i / pcmrate;
+            x[2*h-1] = cos(p);
+            x[2*h]   = sin(p);
+        }
+        for (unsigned int r = 0; r < m; r++) {
+            b[r] += x[r] * y;
+            for (unsigned int c = 0; c < m; c++)
+                a[r * m + c] += x[r] * x[c];
+        }
+    }
+
+    // Solve by Gaussian elimination; the system is well conditioned.
+    for (unsigned int k = 0; k < m; k++) {
+        for (unsigned int r = k + 1; r < m; r++) {
+            double f = a[r * m + k] / a[k * m + k];
+            for (unsigned int c = k; c < m; c++)
+                a[r * m + c] -= f * a[k * m + c];
+            b[r] -= f * b[k];
+        }
+    }
+    vector<double> coef(m);
+    for (unsigned int k = m; k-- > 0; ) {
+        double s = b[k];
+        for (unsigned int c = k + 1; c < m; c++)
+            s -= a[k * m + c] * coef[c];
+        coef[k] = s / a[k * m + k];
+    }
+
+    // Measure the power of the residual.
+    double noise = 0;
+    for (unsigned int i = skip; i < n; i++) {
+        double e = audio[i * nchannel + ch] - coef[0];
+        for (unsigned int h = 1; h <= num_harmonics; h++) {
+            double p = 2 * M_PI * h * tone_freq * i / pcmrate;
+            e -= coef[2*h-1] * cos(p) + coef[2*h] * sin(p);
+        }
+        noise += e * e;
+    }
+    noise /= (n - skip);
+
+    double harm = 0;
+    for (unsigned int h = 2; h <= num_harmonics; h++)
+        harm += coef[2*h-1] * coef[2*h-1] + coef[2*h] * coef[2*h];
+
+    ToneQuality q;
+    q.level = hypot(coef[1], coef[2]);
+    q.snr   = 10 * log10(0.5 * q.level * q.level / noise);
+    q.thd   = 10 * log10(harm / (q.level * q.level));
+    return q;
+}
+
+
+/** Decode a signal with the floating-point decoder. */
+static SampleVector decode_float(const TestConfig& cfg,
+                                 const IQSampleVector& iq)
+{
+    FmDecoder fm(cfg.ifrate,                        // sample_rate_if
+                 -0.25 * cfg.ifrate,                // tuning_offset
+                 cfg.pcmrate,                       // sample_rate_pcm
+                 true,                              // stereo
+                 FmDecoder::default_deemphasis,     // deemphasis
+                 FmDecoder::default_bandwidth_if,   // bandwidth_if
+                 FmDecoder::default_freq_dev,       // freq_dev
+                 FmDecoder::default_bandwidth_pcm,  // bandwidth_pcm
+                 cfg.downsample);                   // downsample
+
+    // Decode in blocks of the size that the receiver reads.
+    SampleVector audio, block_audio;
+    for (unsigned int i = 0; i < iq.size(); i += block_length) {
+        unsigned int n = min(block_length, (unsigned int)(iq.size() - i));
+        IQSampleVector block(iq.begin() + i, iq.begin() + i + n);
+        fm.process(block, block_audio);
+        audio.insert(audio.end(), block_audio.begin(), block_audio.end());
+    }
+    return audio;
+}
+
+
+/** Quantize IQ samples to unsigned 8-bit pairs as read from RTL-SDR. */
+static RawSampleVector quantize_cu8(const IQSampleVector& iq)
+{
+    RawSampleVector raw(2 * iq.size());
+    for (unsigned int i = 0; i < iq.size(); i++) {
+        long re = lrint(128 + 128 * iq[i].real());
+        long im = lrint(128 + 128 * iq[i].imag());
+        raw[2*i]   = min(255L, max(0L, re));
+        raw[2*i+1] = min(255L, max(0L, im));
+    }
+    return raw;
+}
+
+
+/** Decode raw 8-bit IQ data with the fixed-point decoder. */
+static SampleVector decode_fixed(const TestConfig& cfg,
+                                 const RawSampleVector& raw)
+{
+    FmDecoderFixed fm(cfg.ifrate,                        // sample_rate_if
+                      -0.25 * cfg.ifrate,                // tuning_offset
+                      cfg.pcmrate,                       // sample_rate_pcm
+                      true,                              // stereo
+                      FmDecoder::default_deemphasis,     // deemphasis
+                      FmDecoder::default_bandwidth_if,   // bandwidth_if
+                      FmDecoder::default_freq_dev,       // freq_dev
+                      FmDecoder::default_bandwidth_pcm,  // bandwidth_pcm
+                      cfg.downsample);                   // downsample
+
+    SampleVector audio, block_audio;
+    for (unsigned int i = 0; i < raw.size(); i += 2 * block_length) {
+        unsigned int n = min(2 * block_length, (unsigned int)(raw.size() - i));
+        RawSampleVector block(raw.begin() + i, raw.begin() + i + n);
+        fm.process(block, block_audio);
+        audio.insert(audio.end(), block_audio.begin(), block_audio.end());
+    }
+    return audio;
+}
+
+
+/** Decode raw 8-bit IQ data with the floating-point decoder. */
+static SampleVector decode_float_cu8(const TestConfig& cfg,
+                                     const RawSampleVector& raw)
+{
+    IQSampleVector iq(raw.size() / 2);
+    dsp_kernels().convert_cu8(raw.data(), iq.size(), iq.data());
+    return decode_float(cfg, iq);
+}
+
+
+/**
+ * Print one line of tone measurements and return true if they are
+ * within the limits. Without limits, the line is only printed.
+ */
+static bool print_quality(const char * label, const SampleVector& audio,
+                          double pcmrate, const QualityLimit * limit)
+{
+    ToneQuality left  = measure_tone(audio, 0, 2, pcmrate);
+    ToneQuality right = measure_tone(audio, 1, 2, pcmrate);
+    double separation = 20 * log10(left.level / right.level);
+
+    bool ok = true;
+    if (limit) {
+        double min_snr = (sizeof(Sample) == 4) ? limit->min_snr_float
+                                               : limit->min_snr;
+        ok = (left.snr >= min_snr && left.thd <= limit->max_thd &&
+              separation >= limit->min_separation &&
+              separation <= limit->max_separation);
+    }
+    printf("%-16s %8.1f dB %8.1f dB %8.1f dB%s\n", label,
+           left.snr, left.thd, separation, ok ? "" : "  FAIL");
+    return ok;
+}
+
+
+/** Measure tone quality of the floating-point decoder. */
+static bool test_quality(const TestConfig& cfg)
+{
+    printf("%-16s %11s %11s %11s\n", "signal", "snr", "thd", "separation");
+
+    bool ok = true;
+    IQSampleVector iq = make_signal(cfg, true);
+    ok &= print_quality("stereo", decode_float(cfg, iq), cfg.pcmrate,
+                        &stereo_limit);
+
+    // Without pilot both channels carry the tone; separation is 0 dB.
+    iq = make_signal(cfg, false);
+    ok &= print_quality("mono", decode_float(cfg, iq), cfg.pcmrate,
+                        &mono_limit);
+
+    // An adjacent channel at equal level must not leak into the audio.
+    iq = make_signal(cfg, true, 1.0);
+    ok &= print_quality("adjacent", decode_float(cfg, iq), cfg.pcmrate,
+                        &adjacent_limit);
+    return ok;
+}
+
+
+/**
+ * Measure stereo tone quality at each IF rate of the receiver, decimated
+ * as planned by RatePlanner. The higher rates run the half-band stages
+ * of the downconverter.
+ */
+static bool test_rates(const TestConfig& cfg)
+{
+    printf("%-16s %11s %11s %11s\n", "ifrate", "snr", "thd", "separation");
+
+    bool ok = true;
+    RatePlanner planner(cfg.pcmrate, true);
+    for (double ifrate : receiver_ifrates) {
+        RatePlan plan = planner.plan_fixed(ifrate);
+        TestConfig c = cfg;
+        c.ifrate = ifrate;
+        c.downsample = plan.downsample;
+
+        char label[32];
+        snprintf(label, sizeof(label), "%.3f /%u hb%u", 1.0e-6 * ifrate,
+                 plan.downsample, plan.halfband_stages);
+        ok &= print_quality(label, decode_float(c, make_signal(c, true)),
+                            c.pcmrate, &stereo_limit);
+    }
+    return ok;
+}
+
+
+/**
+ * Measure tone quality of the fixed-point decoder against the
+ * floating-point decoder, both fed the same 8-bit IQ data.
+ */
+static bool test_fixed(const TestConfig& cfg)
+{
+    printf("%-16s %11s %11s %11s\n", "signal", "snr", "thd", "separation");
+
+    bool ok = true;
+    RawSampleVector raw = quantize_cu8(make_signal(cfg, true));
+    ok &= print_quality("stereo float", decode_float_cu8(cfg, raw),
+                        cfg.pcmrate, &cu8_stereo_limit);
+    ok &= print_quality("stereo fixed", decode_fixed(cfg, raw),
+                        cfg.pcmrate, &fixed_stereo_limit);
+
+    raw = quantize_cu8(make_signal(cfg, false));
+    ok &= print_quality("mono float", decode_float_cu8(cfg, raw),
+                        cfg.pcmrate, &cu8_mono_limit);
+    ok &= print_quality("mono fixed", decode_fixed(cfg, raw),
+                        cfg.pcmrate, &fixed_mono_limit);
+    return ok;
+}
+
+
+/** Return the time in seconds of a monotonic clock. */
+static double get_time()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Measure FFT throughput for each transform size.
+ *
+ * Set SOFTFM_DSP_LEVEL to compare kernel levels.
+ */
+static void test_fft()
+{
+    typedef FftPlan<Sample>::Complex Complex;
+
+    printf("kernels: %s\n", dsp_kernels().name);
+    printf("%8s %14s %14s %14s\n",
+           "size", "complex", "real", "per point");
+
+    for (unsigned int n = 16; n <= 65536; n *= 2) {
+        shared_ptr<const FftPlan<Sample>> plan = FftPlan<Sample>::get(n);
+        vector<Complex> buf(n);
+        vector<Sample> rbuf(n);
+        for (unsigned int i = 0; i < n; i++) {
+            buf[i] = Complex(sin(0.1 * i), cos(0.3 * i));
+            rbuf[i] = sin(0.1 * i);
+        }
+
+        // Repeat each transform for a few ms of CPU time and keep the
+        // fastest of several runs.
+        unsigned int reps = max(1u, 1000000u / n);
+        double t_complex = 1.0e9, t_real = 1.0e9;
+        for (unsigned int run = 0; run < fft_runs; run++) {
+            double t0 = get_time();
+            for (unsigned int r = 0; r < reps; r++)
+                plan->forward(buf.data(), buf.data());
+            double t1 = get_time();
+            for (unsigned int r = 0; r < reps; r++)
+                plan->forward_real(rbuf.data(), buf.data());
+            double t2 = get_time();
+            t_complex = min(t_complex, (t1 - t0) / reps);
+            t_real = min(t_real, (t2 - t1) / reps);
+        }
+
+        printf("%8u %11.0f ns %11.0f ns %11.2f ns\n", n,
+               t_complex * 1.0e9, t_real * 1.0e9, t_complex * 1.0e9 / n);
+    }
+}
+
+
+/**
+ * Measure the stereo decoding time for a range of strip lengths.
+ *
+ * Strip length 0 runs every stage over the whole block.
+ */
+static void test_strip(const TestConfig& cfg)
+{
+    static const unsigned int strip_lengths[] = {
+        0, 1024, 2048, 4096, 8192, 16384, 32768 };
+
+    printf("%8s %14s\n", "strip", "time");
+
+    IQSampleVector iq = make_signal(cfg, true);
+    SampleVector block_audio;
+
+    for (unsigned int strip : strip_lengths) {
+        double best = 1.0e9;
+        for (unsigned int run = 0; run < strip_runs; run++) {
+            FmDecoder fm(cfg.ifrate,                        // sample_rate_if
+                         -0.25 * cfg.ifrate,                // tuning_offset
+                         cfg.pcmrate,                       // sample_rate_pcm
+                         true,                              // stereo
+                         FmDecoder::default_deemphasis,     // deemphasis
+                         FmDecoder::default_bandwidth_if,   // bandwidth_if
+                         FmDecoder::default_freq_dev,       // freq_dev
+                         FmDecoder::default_bandwidth_pcm,  // bandwidth_pcm
+                         cfg.downsample);                   // downsample
+            fm.set_strip_length(strip);
+
+            double t = 0;
+            for (unsigned int i = 0; i < iq.size(); i += block_length) {
+                unsigned int n = min(block_length,
+                                     (unsigned int)(iq.size() - i));
+                IQSampleVector block(iq.begin() + i, iq.begin() + i + n);
+                double t0 = get_time();
+                fm.process(block, block_audio);
+                t += get_time() - t0;
+            }
+            best = min(best, t);
+        }
+
+        printf("%8u %8.2f ms/s\n", strip, 1.0e3 * best / cfg.seconds);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    TestConfig cfg;
+    cfg.ifrate      = 1.0e6;
+    cfg.pcmrate     = 44100;
+    cfg.downsample  = 0;
+    cfg.seconds     = 3;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:r:D:t:")) >= 0) {
+        switch (c) {
+            case 's':
+                cfg.ifrate = atof(optarg);
+                break;
+            case 'r':
+                cfg.pcmrate = atof(optarg);
+                break;
+            case 'D':
+                cfg.downsample = atoi(optarg);
+                break;
+            case 't':
+                cfg.seconds = atof(optarg);
+                break;
+            default:
+                usage();
+                fprintf(stderr, "ERROR: Invalid command line options\n");
+                exit(1);
+        }
+    }
+
+    if (cfg.ifrate <= 0 || cfg.pcmrate <= 0 || cfg.seconds <= settle_time) {
+        usage();
+        fprintf(stderr, "ERROR: Invalid sample rate or length\n");
+        exit(1);
+    }
+
+    if (cfg.downsample == 0) {
+        RatePlanner planner(cfg.pcmrate, true);
+        cfg.downsample = planner.plan_fixed(cfg.ifrate).downsample;
+    }
+
+    unsigned int halfband_stages = DownconverterIQ::count_halfband_stages(
+        FmDecoder::if_filter_cutoff(cfg.ifrate, FmDecoder::default_bandwidth_if,
+                                    cfg.downsample),
+        cfg.downsample);
+
+    printf("build: %s samples\n", sizeof(Sample) == 4 ? "float" : "double");
+    printf("ifrate %.0f Hz, downsample %u (%u half-band), pcmrate %.0f Hz\n",
+           cfg.ifrate, cfg.downsample, halfband_stages, cfg.pcmrate);
+
+    vector<string> tests(argv + optind, argv + argc);
+    if (tests.empty())
+        tests.push_back("quality");
+
+    bool ok = true;
+    for (const string& test : tests) {
+        printf("\n");
+        if (test == "quality") {
+            ok &= test_quality(cfg);
+        } else if (test == "rates") {
+            ok &= test_rates(cfg);
+        } else if (test == "fixed") {
+            ok &= test_fixed(cfg);
+        } else if (test == "fft") {
+            test_fft();
+        } else if (test == "strip") {
+            test_strip(cfg);
+        } else {
+            usage();
+            fprintf(stderr, "ERROR: Unknown test '%s'\n", test.c_str());
+            exit(1);
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Decode quality below limits\n");
+        exit(1);
+    }
+
+    return 0;
+}
+
+/* end */
@@ -0,0 +1,25 @@
+TARGET = dsptest
+TEMPLATE = app
+
+DEPENDPATH += .
+INCLUDEPATH += . ../../3rdparty/SoftFM
+
+CONFIG += console c++11 thread release
+CONFIG -= qt app_bundle
+
+# Build with the same flags as the receiver to compare both decode chains:
+# qmake CONFIG+=sample_float
+sample_float: DEFINES += SOFTFM_SAMPLE_FLOAT
+stage_timing: DEFINES += SOFTFM_STAGE_TIMING
+
+HEADERS += ../../3rdparty/SoftFM/Arena.h ../../3rdparty/SoftFM/DspKernels.h ../../3rdparty/SoftFM/Fft.h \
+../../3rdparty/SoftFM/Filter.h \
+../../3rdparty/SoftFM/FmDecode.h ../../3rdparty/SoftFM/RatePlanner.h ../../3rdparty/SoftFM/SoftFM.h \
+../../3rdparty/SoftFM/StageTiming.h
+SOURCES += ../../3rdparty/SoftFM/Arena.cc ../../3rdparty/SoftFM/DspKernels.cc ../../3rdparty/SoftFM/Fft.cc \
+../../3rdparty/SoftFM/Filter.cc \
+../../3rdparty/SoftFM/FmDecode.cc ../../3rdparty/SoftFM/RatePlanner.cc
+
+SOURCES += dsptest.cpp
+
+OBJECTS_DIR = .build/obj